@@ -1,5 +1,8 @@
 #pragma once
 
+#include <optional>
+#include <span>
+
 #include "../array_vec.hpp"
 #include "../utils.hpp"
 #include "attacks.hpp"
@@ -7,9 +10,9 @@
 #include "types.hpp"
 #include "util.hpp"
 
-constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
-    ArrayVec<MontyformatMove, 256> moves;
-
+// Calls onMove(pieceTypeMoved, move) for every legal move, always in the same order
+template <typename OnMove>
+constexpr void forEachLegalMove(const Position& pos, OnMove&& onMove) {
     const Color stm = pos.mSideToMove;
     const Square ourKingSq = pos.getKingSq(stm);
     const u64 occ = pos.getOcc();
@@ -22,13 +25,13 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
     while (kingAttacks > 0) {
         const Square dst = popLsb(kingAttacks);
         const MfMoveFlag flag = bbContainsSq(occ, dst) ? MfMoveFlag::Capture : MfMoveFlag::Quiet;
-        moves.pushBack(MontyformatMove(ourKingSq, dst, flag));
+        onMove(PieceType::King, MontyformatMove(ourKingSq, dst, flag));
     }
 
     // If 2 checkers, only king moves are legal
     const u64 checkers = pos.getCheckers();
     if (std::popcount(checkers) > 1) {
-        return moves;
+        return;
     }
 
     // Castling
@@ -42,7 +45,8 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
                 BETWEEN_EXCLUSIVE_BB[static_cast<size_t>(ourKingSq)][static_cast<size_t>(rookSrc)];
 
             if (((occ | enemyAtks) & btwnExcl) == 0) {
-                moves.pushBack(MontyformatMove(ourKingSq, kingDst, MfMoveFlag::CastlingKs));
+                onMove(PieceType::King,
+                       MontyformatMove(ourKingSq, kingDst, MfMoveFlag::CastlingKs));
             }
         }
 
@@ -57,7 +61,8 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
 
             if ((occ & btwnExcl) == 0 && !bbContainsSq(enemyAtks, kingDst) &&
                 !bbContainsSq(enemyAtks, rookDst)) {
-                moves.pushBack(MontyformatMove(ourKingSq, kingDst, MfMoveFlag::CastlingQs));
+                onMove(PieceType::King,
+                       MontyformatMove(ourKingSq, kingDst, MfMoveFlag::CastlingQs));
             }
         }
     }
@@ -88,7 +93,7 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
 
         if (!isBackrank(rankOf(dst))) {
             const auto flag = isCapture ? MfMoveFlag::Capture : MfMoveFlag::Quiet;
-            moves.pushBack(MontyformatMove(src, dst, flag));
+            onMove(PieceType::Pawn, MontyformatMove(src, dst, flag));
             return;
         }
 
@@ -98,7 +103,8 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
             static_cast<u16>(isCapture ? MfMoveFlag::KnightPromoCapture : MfMoveFlag::KnightPromo);
 
         for (size_t i = 0; i < 4; i++) {
-            moves.pushBack(MontyformatMove(src, dst, static_cast<MfMoveFlag>(baseFlag + i)));
+            const auto flag = static_cast<MfMoveFlag>(baseFlag + i);
+            onMove(PieceType::Pawn, MontyformatMove(src, dst, flag));
         }
     };
 
@@ -155,7 +161,8 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
             static_cast<Square>(static_cast<i32>(src) + (stm == Color::White ? 16 : -16));
 
         if (!bbContainsSq(occ, doublePushDst) && bbContainsSq(movableBb, doublePushDst)) {
-            moves.pushBack(MontyformatMove(src, doublePushDst, MfMoveFlag::PawnDoublePush));
+            onMove(PieceType::Pawn,
+                   MontyformatMove(src, doublePushDst, MfMoveFlag::PawnDoublePush));
         }
     }
 
@@ -180,7 +187,7 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
                 rooksQueens & ROOK_ATTACKS[static_cast<size_t>(ourKingSq)].attacks(occAfterEp);
 
             if ((them & sliderAttackers) == 0) {
-                moves.pushBack(MontyformatMove(src, epSquare, MfMoveFlag::EnPassant));
+                onMove(PieceType::Pawn, MontyformatMove(src, epSquare, MfMoveFlag::EnPassant));
             }
         }
     }
@@ -196,7 +203,7 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
         while (knightMoves > 0) {
             const Square dst = popLsb(knightMoves);
             const auto flag = bbContainsSq(occ, dst) ? MfMoveFlag::Capture : MfMoveFlag::Quiet;
-            moves.pushBack(MontyformatMove(src, dst, flag));
+            onMove(PieceType::Knight, MontyformatMove(src, dst, flag));
         }
     }
 
@@ -213,7 +220,7 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
         while (bishopMoves > 0) {
             const Square dst = popLsb(bishopMoves);
             const auto flag = bbContainsSq(occ, dst) ? MfMoveFlag::Capture : MfMoveFlag::Quiet;
-            moves.pushBack(MontyformatMove(src, dst, flag));
+            onMove(PieceType::Bishop, MontyformatMove(src, dst, flag));
         }
     }
 
@@ -230,7 +237,7 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
         while (rookMoves > 0) {
             const Square dst = popLsb(rookMoves);
             const auto flag = bbContainsSq(occ, dst) ? MfMoveFlag::Capture : MfMoveFlag::Quiet;
-            moves.pushBack(MontyformatMove(src, dst, flag));
+            onMove(PieceType::Rook, MontyformatMove(src, dst, flag));
         }
     }
 
@@ -247,9 +254,67 @@ constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
         while (queenMoves > 0) {
             const Square dst = popLsb(queenMoves);
             const auto flag = bbContainsSq(occ, dst) ? MfMoveFlag::Capture : MfMoveFlag::Quiet;
-            moves.pushBack(MontyformatMove(src, dst, flag));
+            onMove(PieceType::Queen, MontyformatMove(src, dst, flag));
         }
     }
+}
+
+constexpr ArrayVec<MontyformatMove, 256> getLegalMoves(const Position& pos) {
+    ArrayVec<MontyformatMove, 256> moves;
+
+    forEachLegalMove(pos, [&moves](const PieceType, const MontyformatMove move) {
+        moves.pushBack(move);
+    });
 
     return moves;
 }
+
+// Writes the policy index of every legal move to policyIdxs, in getLegalMoves() order
+// Policy index = [pieceTypeMoved][dstSquare][pieceTypeCaptured] (King if not a capture)
+// Destination squares are flipped horizontally if mirrorFiles, and vertically for underpromotions
+// Returns the number of legal moves, and sets bestMoveIdx to the index of bestMove
+// Unlike getLegalMoves() + pieceAt(), captured piece types come straight from the bitboards
+constexpr size_t getPolicyIdxs(const Position& pos,
+                               const MontyformatMove bestMove,
+                               const bool mirrorFiles,
+                               std::span<i16> policyIdxs,
+                               std::optional<size_t>& bestMoveIdx) {
+    // Bit k of the type of the piece on each square, with empty squares being King (no capture)
+    const u64 empty = ~pos.getOcc();
+
+    const u64 ptBit0 = pos.getBb(PieceType::Knight) | pos.getBb(PieceType::Rook) |
+                       pos.getBb(PieceType::King) | empty;
+
+    const u64 ptBit1 = pos.getBb(PieceType::Bishop) | pos.getBb(PieceType::Rook);
+    const u64 ptBit2 = pos.getBb(PieceType::Queen) | pos.getBb(PieceType::King) | empty;
+
+    const u8 dstXor = mirrorFiles ? 7 : 0;
+
+    size_t numMoves = 0;
+    bestMoveIdx = std::nullopt;
+
+    forEachLegalMove(pos, [&](const PieceType pieceType, const MontyformatMove move) {
+        assert(numMoves < policyIdxs.size());
+
+        const u8 dst = static_cast<u8>(move.getDst());
+
+        const u8 ptCaptured = move.isEnPassant() ? static_cast<u8>(PieceType::Pawn)
+                                                 : static_cast<u8>(((ptBit0 >> dst) & 1) |
+                                                                   ((ptBit1 >> dst) & 1) << 1 |
+                                                                   ((ptBit2 >> dst) & 1) << 2);
+
+        const bool underpromo = move.isPromo() && move.getPromoPt() != PieceType::Queen;
+        const u8 dstForIdx = static_cast<u8>(dst ^ dstXor ^ (underpromo ? 56 : 0));
+
+        policyIdxs[numMoves] = static_cast<i16>(static_cast<u8>(pieceType) * 64 * 6 +
+                                                dstForIdx * 6 + ptCaptured);
+
+        if (move == bestMove) {
+            bestMoveIdx = numMoves;
+        }
+
+        numMoves++;
+    });
+
+    return numMoves;
+}
@@ -1,12 +1,102 @@
+#include <array>
 #include <cassert>
+#include <optional>
 #include <print>
+#include <span>
 
 #include "../utils.hpp"
+#include "move_gen.hpp"
 #include "perft.hpp"
 #include "position.hpp"
 #include "types.hpp"
 #include "util.hpp"
 
+// Policy indices computed the way featurize() did before getPolicyIdxs(),
+// from getLegalMoves(), pieceAt() and flipped moves
+constexpr size_t getPolicyIdxsReference(const Position& pos,
+                                        const MontyformatMove bestMove,
+                                        const bool mirrorFiles,
+                                        std::span<i16> policyIdxs,
+                                        std::optional<size_t>& bestMoveIdx) {
+    const auto legalMoves = getLegalMoves(pos);
+    bestMoveIdx = std::nullopt;
+
+    for (size_t i = 0; i < legalMoves.size(); i++) {
+        const MontyformatMove move = legalMoves[i];
+        const MontyformatMove moveOriented = mirrorFiles ? move.filesFlipped() : move;
+
+        const PieceType pieceType = pos.pieceAt(move.getSrc()).value().second;
+
+        const PieceType ptCaptured = move.isEnPassant() ? PieceType::Pawn
+                                     : move.isCapture()
+                                         ? pos.pieceAt(move.getDst()).value().second
+                                         : PieceType::King;
+
+        const Square dstForIdx = move.isPromo() && move.getPromoPt().value() != PieceType::Queen
+                                     ? rankFlipped(moveOriented.getDst())
+                                     : moveOriented.getDst();
+
+        policyIdxs[i] = static_cast<i16>(static_cast<i16>(pieceType) * 64 * 6 +
+                                         static_cast<i16>(dstForIdx) * 6 +
+                                         static_cast<i16>(ptCaptured));
+
+        if (move == bestMove) {
+            bestMoveIdx = i;
+        }
+    }
+
+    return legalMoves.size();
+}
+
+// Special moves seen by testPolicyIdxs()
+struct SpecialMoveCounts {
+   public:
+    u64 enPassants = 0;
+    u64 underpromos = 0;
+    u64 castlings = 0;
+};
+
+// Asserts getPolicyIdxs() matches getPolicyIdxsReference() in every position perft visits
+// up to depth, with and without mirroring, for every legal move as best move and a null one
+constexpr void testPolicyIdxs(const Position& pos, const i32 depth, SpecialMoveCounts& counts) {
+    const auto legalMoves = getLegalMoves(pos);
+
+    for (const bool mirrorFiles : {false, true}) {
+        for (size_t bestIdx = 0; bestIdx <= legalMoves.size(); bestIdx++) {
+            const MontyformatMove bestMove =
+                bestIdx < legalMoves.size() ? legalMoves[bestIdx] : MontyformatMove(0);
+
+            std::array<i16, 256> idxs, expectedIdxs;
+            std::optional<size_t> bestMoveIdx, expectedBestMoveIdx;
+
+            const size_t numMoves = getPolicyIdxs(pos, bestMove, mirrorFiles, idxs, bestMoveIdx);
+
+            const size_t expectedNumMoves = getPolicyIdxsReference(
+                pos, bestMove, mirrorFiles, expectedIdxs, expectedBestMoveIdx);
+
+            assert(numMoves == expectedNumMoves);
+            assert(bestMoveIdx == expectedBestMoveIdx);
+            assert(bestIdx == legalMoves.size() || bestMoveIdx == bestIdx);
+
+            for (size_t i = 0; i < numMoves; i++) {
+                assert(idxs[i] == expectedIdxs[i]);
+            }
+        }
+    }
+
+    for (const MontyformatMove move : legalMoves) {
+        counts.enPassants += move.isEnPassant();
+        counts.underpromos += move.isPromo() && move.getPromoPt() != PieceType::Queen;
+        counts.castlings += move.isKsCastling() || move.isQsCastling();
+
+        if (depth > 1) {
+            Position newPos = pos;
+            newPos.makeMove(move);
+            testPolicyIdxs(newPos, depth - 1, counts);
+        }
+    }
+}
+
 int main() {
     // https:www.chessprogramming.org/Perft_Results
 
@@ -55,6 +145,17 @@ int main() {
     // Kiwipete perft(5)
     assert(perft(pos2Kiwipete, 5) == 193690690ULL);
 
+    // Policy indices, over positions with en passant, promotions and castling
+    SpecialMoveCounts counts;
+    testPolicyIdxs(pos1Start, 3, counts);
+    testPolicyIdxs(pos2Kiwipete, 2, counts);
+    testPolicyIdxs(pos3, 3, counts);
+    testPolicyIdxs(pos4, 3, counts);
+    testPolicyIdxs(pos4Mirrored, 3, counts);
+    testPolicyIdxs(pos5, 2, counts);
+
+    assert(counts.enPassants > 0 && counts.underpromos > 0 && counts.castlings > 0);
+
     std::println("Passed!");
     return 0;
 }
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../dataloader/compressed_block.hpp"
+#include "../trace.hpp"
+#include "../utils.hpp"
+#include "data_entry.hpp"
+#include "data_stamp_writer.hpp"
+
+// Writes a compressed data file (see CompressedFileHeader), 1 block of data entries at a time,
+// and its stamp (see DataStampHeader)
+class CompressedFileWriter {
+   private:
+    std::ofstream mFile;
+    size_t mBlockEntries;
+    size_t mNumEntries = 0;
+
+    std::vector<StarwayDataEntry> mBlock;
+    std::vector<u64> mBlockOffsets;
+    std::vector<u8> mCompressedBytes;
+
+    u64 mCompressedSizeBytes = 0;
+
+    DataStampWriter mStamp;
+
+   public:
+    CompressedFileWriter(const std::string& path, const size_t blockEntries)
+        : mStamp(path, blockEntries) {
+        assert(blockEntries > 0);
+
+        mFile = std::ofstream(path, std::ios::binary);
+        assert(mFile);
+
+        mBlockEntries = blockEntries;
+
+        // Header is written last, once the entry count and index offset are known
+        const CompressedFileHeader header = {};
+        mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        assert(mFile);
+    }
+
+    constexpr u64 compressedSizeBytes() const { return mCompressedSizeBytes; }
+
+    constexpr void write(const StarwayDataEntry& entry) {
+        mBlock.push_back(entry);
+        mNumEntries++;
+
+        if (mBlock.size() == mBlockEntries) {
+            writeBlock();
+        }
+    }
+
+    // Writes the last block (possibly smaller), the block index, the header and the stamp
+    constexpr void finish() {
+        if (!mBlock.empty()) {
+            writeBlock();
+        }
+
+        const u64 indexOffset = static_cast<u64>(mFile.tellp());
+        mBlockOffsets.push_back(indexOffset);
+
+        mFile.write(reinterpret_cast<const char*>(mBlockOffsets.data()),
+                    static_cast<i64>(mBlockOffsets.size() * sizeof(u64)));
+
+        const u64 fileSizeBytes = static_cast<u64>(mFile.tellp());
+
+        CompressedFileHeader header;
+        header.mMagic = COMPRESSED_MAGIC;
+        header.mVersion = COMPRESSED_VERSION;
+        header.mNumEntries = mNumEntries;
+        header.mBlockEntries = mBlockEntries;
+        header.mIndexOffset = indexOffset;
+
+        mFile.seekp(0, std::ios::beg);
+        mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        mFile.close();
+        assert(mFile);
+
+        mStamp.finish(fileSizeBytes);
+    }
+
+   private:
+    constexpr void writeBlock() {
+        const TraceSpan span("compress block");
+
+        mBlockOffsets.push_back(static_cast<u64>(mFile.tellp()));
+
+        mCompressedBytes.clear();
+        compressBlock(mBlock.data(), mBlock.size(), mCompressedBytes);
+
+        // Assert the block decompresses to the exact same entries
+        std::vector<StarwayDataEntry> decompressed(mBlock.size());
+
+        decompressBlock(
+            mCompressedBytes.data(), mCompressedBytes.size(), mBlock.size(), decompressed.data());
+
+        assert(std::memcmp(decompressed.data(),
+                           mBlock.data(),
+                           mBlock.size() * sizeof(StarwayDataEntry)) == 0);
+
+        mFile.write(reinterpret_cast<const char*>(mCompressedBytes.data()),
+                    static_cast<i64>(mCompressedBytes.size()));
+
+        assert(mFile);
+
+        mStamp.addBlock(mCompressedBytes.data(), mCompressedBytes.size());
+
+        mCompressedSizeBytes += mCompressedBytes.size();
+        mBlock.clear();
+    }
+
+};  // class CompressedFileWriter
@@ -36,7 +36,15 @@ enum class Mask : u32 {
     // 21-22: Game result (0 if stm lost, 1 if draw, 2 if stm won)
     STM_RESULT = 0b11u << 20,
 
-    // 23-32: unused
+    // 23-30: number of legal moves (0 if unknown, in data files converted before it was stored)
+    // so the dataloader can filter entries by it without generating legal moves
+    NUM_LEGAL_MOVES = 0xFFu << 22,
+
+    // 31: never set, while FEATURIZED_MAGIC and COMPRESSED_MAGIC have it set,
+    // so a Starway data file can never be mistaken for another format
+    NEVER_SET = 1u << 30,
+
+    // 32: unused
 };
 
 struct StarwayDataEntry {
@@ -72,10 +80,11 @@ struct StarwayDataEntry {
     }
 
     // Calculate and set mMiscData
-    constexpr void setMiscData(const Position& pos, const u8 stmResult) {
+    constexpr void setMiscData(const Position& pos, const u8 stmResult, const size_t numLegalMoves) {
         mMiscData = 0;
 
         assert(stmResult <= 2);
+        assert(numLegalMoves > 0 && numLegalMoves <= 255);
 
         const Square ourKingSqOriented =
             maybeRankFlipped(pos.getKingSq(pos.mSideToMove), pos.mSideToMove);
@@ -99,6 +108,7 @@ struct StarwayDataEntry {
         }
 
         set(Mask::STM_RESULT, stmResult);
+        set(Mask::NUM_LEGAL_MOVES, static_cast<u32>(numLegalMoves));
     }
 
     // Calculate and set mOccupied and mPieces
@@ -138,6 +148,7 @@ struct StarwayDataEntry {
     constexpr void validate() const {
         assert(get(Mask::EP_FILE) <= 8);
         assert(get(Mask::STM_RESULT) <= 2);
+        assert(get(Mask::NEVER_SET) == 0);
         assert(std::popcount(mOccupied) > 2 && std::popcount(mOccupied) <= 32);
         assert(bbContainsSq(mOccupied, static_cast<Square>(get(Mask::OUR_KING_SQ_ORIENTED))));
         assert(bbContainsSq(mOccupied, static_cast<Square>(get(Mask::THEIR_KING_SQ_ORIENTED))));
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cassert>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../dataloader/data_stamp.hpp"
+#include "../utils.hpp"
+
+// Computes the stamp of a data file (see DataStampHeader) as the converter writes it,
+// so the data file never has to be read again
+// Only stamp data files whose data entries were all validated
+class DataStampWriter {
+   private:
+    std::string mDataFilePath;
+    size_t mBlockEntries;
+
+    std::vector<u32> mBlockCrcs;
+    u32 mCrc = 0;
+    size_t mEntriesInBlock = 0;
+
+   public:
+    constexpr DataStampWriter(const std::string& dataFilePath, const size_t blockEntries) {
+        assert(blockEntries > 0);
+
+        mDataFilePath = dataFilePath;
+        mBlockEntries = blockEntries;
+    }
+
+    // For uncompressed data files, every data entry's bytes, in order
+    constexpr void addEntry(const void* entryBytes, const size_t numBytes) {
+        mCrc = crc32c(mCrc, entryBytes, numBytes);
+        mEntriesInBlock++;
+
+        if (mEntriesInBlock == mBlockEntries) {
+            mBlockCrcs.push_back(mCrc);
+            mCrc = 0;
+            mEntriesInBlock = 0;
+        }
+    }
+
+    // For compressed data files, every block's compressed bytes, in order
+    constexpr void addBlock(const u8* blockBytes, const size_t numBytes) {
+        assert(mEntriesInBlock == 0);
+        mBlockCrcs.push_back(crc32c(0, blockBytes, numBytes));
+    }
+
+    // Writes the stamp file, once the data file is complete
+    constexpr void finish(const size_t dataFileSizeBytes) {
+        // Last block may have fewer entries
+        if (mEntriesInBlock > 0) {
+            mBlockCrcs.push_back(mCrc);
+            mCrc = 0;
+            mEntriesInBlock = 0;
+        }
+
+        DataStampHeader header;
+        header.mMagic = DATA_STAMP_MAGIC;
+        header.mVersion = DATA_STAMP_VERSION;
+        header.mFileSizeBytes = dataFileSizeBytes;
+        header.mBlockEntries = mBlockEntries;
+        header.mNumBlocks = mBlockCrcs.size();
+
+        std::ofstream stampFile(stampPath(mDataFilePath), std::ios::binary);
+        assert(stampFile);
+
+        stampFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        stampFile.write(reinterpret_cast<const char*>(mBlockCrcs.data()),
+                        static_cast<i64>(mBlockCrcs.size() * sizeof(u32)));
+
+        stampFile.close();
+        assert(stampFile);
+    }
+
+};  // class DataStampWriter
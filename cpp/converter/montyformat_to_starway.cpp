@@ -5,6 +5,9 @@ Usage:
     <output data file>
     <batch size>
     <batches to output>
+    [--featurized <output pre-featurized data file>]
+    [--compressed <output compressed data file>]
+    [--trace <output Chrome trace JSON file>]
 */
 
 // Montyformat docs:
@@ -17,6 +20,7 @@ Usage:
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <print>
 #include <random>
 #include <vector>
@@ -25,20 +29,27 @@ Usage:
 #include "../chess/position.hpp"
 #include "../chess/types.hpp"
 #include "../chess/util.hpp"
+#include "../dataloader/featurized_entry.hpp"
+#include "../trace.hpp"
 #include "../utils.hpp"
 #include "compressed_board.hpp"
+#include "compressed_file_writer.hpp"
 #include "data_entry.hpp"
 #include "data_filter.hpp"
+#include "data_stamp_writer.hpp"
 
 int main(int argc, char* argv[]) {
     if (argc < 5) {
         std::println(std::cerr,
-                     "Usage: {} {} {} {} {}",
+                     "Usage: {} {} {} {} {} {} {} {}",
                      argv[0],
                      "<montyformat input file>",
                      "<output data file>",
                      "<batch size>",
-                     "<batches to output>");
+                     "<batches to output>",
+                     "[--featurized <output pre-featurized data file>]",
+                     "[--compressed <output compressed data file>]",
+                     "[--trace <output Chrome trace JSON file>]");
 
         return 1;
     }
@@ -49,12 +60,47 @@ int main(int argc, char* argv[]) {
     const size_t batchSize = std::stoull(argv[3]);
     const size_t targetNumBatches = std::stoull(argv[4]);
 
+    // Read optional program args
+    std::optional<std::string> featurizedFilePath = std::nullopt;
+    std::optional<std::string> compressedFilePath = std::nullopt;
+    std::optional<std::string> traceFilePath = std::nullopt;
+
+    for (int i = 5; i < argc; i++) {
+        const std::string arg = argv[i];
+
+        if (arg == "--featurized" && i + 1 < argc) {
+            featurizedFilePath = argv[++i];
+        } else if (arg == "--compressed" && i + 1 < argc) {
+            compressedFilePath = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            traceFilePath = argv[++i];
+        } else {
+            std::println(std::cerr, "Unknown or incomplete arg: {}", arg);
+            return 1;
+        }
+    }
+
     // Print program args
     std::println("Input data file: {}", mfFilePath);
     std::println("Output data file: {}", outDataFilePath);
     std::println("Batch size: {} data entries", batchSize);
     std::println("Batches to output: {}", targetNumBatches);
 
+    if (featurizedFilePath.has_value()) {
+        std::println("Output pre-featurized data file: {}", *featurizedFilePath);
+    }
+
+    if (compressedFilePath.has_value()) {
+        std::println("Output compressed data file: {}", *compressedFilePath);
+    }
+
+    if (traceFilePath.has_value()) {
+        std::println("Output trace file: {}", *traceFilePath);
+
+        gTracer.start();
+        setTraceThreadName("converter");
+    }
+
     assert(batchSize > 0);
     assert(targetNumBatches > 0);
 
@@ -65,6 +111,37 @@ int main(int argc, char* argv[]) {
     assert(mfFile);
     assert(outDataFile);
 
+    // Every data entry written is validated, so output data files are stamped (see DataStampHeader),
+    // with blocks of batchSize entries
+    DataStampWriter outDataStamp(outDataFilePath, batchSize);
+    std::optional<DataStampWriter> featurizedStamp = std::nullopt;
+
+    // Pre-featurized data file has the same data entries, featurized, after a header
+    std::ofstream featurizedFile;
+
+    if (featurizedFilePath.has_value()) {
+        featurizedFile = std::ofstream(*featurizedFilePath, std::ios::binary);
+        assert(featurizedFile);
+
+        FeaturizedFileHeader header;
+        header.mMagic = FEATURIZED_MAGIC;
+        header.mVersion = FEATURIZED_VERSION;
+        header.mEntrySize = sizeof(FeaturizedEntry);
+        header.mUnused = 0;
+
+        featurizedFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        assert(featurizedFile);
+
+        featurizedStamp.emplace(*featurizedFilePath, batchSize);
+    }
+
+    // Compressed data file has the same data entries, in compressed blocks of batchSize entries
+    std::optional<CompressedFileWriter> compressedFile = std::nullopt;
+
+    if (compressedFilePath.has_value()) {
+        compressedFile.emplace(*compressedFilePath, batchSize);
+    }
+
     DataFilter dataFilter = DataFilter();
 
     size_t gameNum = 0;
@@ -78,6 +155,9 @@ int main(int argc, char* argv[]) {
     };
 
     while (entriesWritten < targetNumBatches * batchSize) {
+        TraceSpan gameSpan("game");
+        const size_t entriesBeforeGame = entriesWritten;
+
         // Read compressed board
         CompressedBoard compressedBoard;
         mfFile.read(reinterpret_cast<char*>(&compressedBoard), sizeof(compressedBoard));
@@ -132,7 +212,7 @@ int main(int argc, char* argv[]) {
                 const u8 stmResult =
                     pos.mSideToMove == Color::White ? mfWhiteResult : 2 - mfWhiteResult;
 
-                entry.setMiscData(pos, stmResult);
+                entry.setMiscData(pos, stmResult, legalMoves.size());
                 entry.setOccAndPieces(pos);
 
                 entry.mStmScore = pos.mSideToMove == Color::White ? mfWhiteScore
@@ -146,6 +226,23 @@ int main(int argc, char* argv[]) {
                 outDataFile.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
                 assert(outDataFile);
 
+                outDataStamp.addEntry(&entry, sizeof(entry));
+
+                if (featurizedFile.is_open()) {
+                    const FeaturizedEntry featurized = featurize(entry);
+
+                    featurizedFile.write(reinterpret_cast<const char*>(&featurized),
+                                         sizeof(featurized));
+
+                    assert(featurizedFile);
+
+                    featurizedStamp->addEntry(&featurized, sizeof(featurized));
+                }
+
+                if (compressedFile.has_value()) {
+                    compressedFile->write(entry);
+                }
+
                 entriesWritten++;
             } else {
                 entriesSkipped++;
@@ -160,10 +257,39 @@ int main(int argc, char* argv[]) {
             pos.makeMove(mfBestMove);
             pos.validate();
         }
+
+        gameSpan.setArg("entries written", static_cast<double>(entriesWritten - entriesBeforeGame));
     }
 
     std::println("\nFinished; parsed {} games", gameNum);
     printProgress();
 
+    const u64 outDataFileSizeBytes = static_cast<u64>(outDataFile.tellp());
+    outDataFile.close();
+    assert(outDataFile);
+    outDataStamp.finish(outDataFileSizeBytes);
+
+    if (featurizedFile.is_open()) {
+        const u64 featurizedFileSizeBytes = static_cast<u64>(featurizedFile.tellp());
+        featurizedFile.close();
+        assert(featurizedFile);
+        featurizedStamp->finish(featurizedFileSizeBytes);
+    }
+
+    if (compressedFile.has_value()) {
+        compressedFile->finish();
+
+        std::println("Compressed data entries: {} bytes ({:.2f} bytes per data entry)",
+                     compressedFile->compressedSizeBytes(),
+                     static_cast<double>(compressedFile->compressedSizeBytes()) /
+                         static_cast<double>(std::max<size_t>(entriesWritten, 1)));
+    }
+
+    std::println("Stamped output data files (see <data file>.stamp)");
+
+    if (traceFilePath.has_value()) {
+        gTracer.stop(*traceFilePath);
+    }
+
     return 0;
 }
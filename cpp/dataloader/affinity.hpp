@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <print>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "../utils.hpp"
+
+// Thread and memory placement for dataloader threads (Linux only, no libnuma needed)
+// Fails gracefully: no pinning on other OSes, no NUMA memory policy on single-node machines
+
+// From linux/mempolicy.h
+constexpr int MPOL_DEFAULT_POLICY = 0;
+constexpr int MPOL_PREFERRED_POLICY = 1;
+
+constexpr size_t MAX_NUMA_NODES = 1024;
+
+// Cores and NUMA node of a worker's threads
+struct WorkerPlacement {
+   public:
+    // cpus[0] for the worker thread, cpus[i] for its helper thread i
+    // Empty if the worker's threads aren't pinned
+    std::vector<size_t> cpus = {};
+
+    // Memory the worker's threads touch 1st goes on this node, if >= 0
+    i64 numaNode = -1;
+};
+
+// Parses a Linux cpulist such as "0-3,8,10-11"
+constexpr std::vector<size_t> parseCpuList(std::string cpuList) {
+    trim(cpuList);
+
+    std::vector<size_t> cpus;
+
+    if (cpuList.empty()) {
+        return cpus;
+    }
+
+    for (std::string range : split(cpuList, ',')) {
+        trim(range);
+
+        const size_t dashPos = range.find('-');
+        const size_t first = std::stoull(range.substr(0, dashPos));
+
+        const size_t last =
+            dashPos == std::string::npos ? first : std::stoull(range.substr(dashPos + 1));
+
+        for (size_t cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+// Cores this process may run on
+inline std::vector<size_t> allowedCpus() {
+    std::vector<size_t> cpus;
+
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+
+    if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0) {
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &cpuSet)) {
+                cpus.push_back(cpu);
+            }
+        }
+
+        return cpus;
+    }
+#endif
+
+    for (size_t cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++) {
+        cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+// 1 if the machine isn't NUMA or it can't be known
+inline size_t numNumaNodes() {
+    size_t numNodes = 0;
+    std::error_code errorCode;
+
+    for (const auto& dirEntry :
+         std::filesystem::directory_iterator("/sys/devices/system/node", errorCode)) {
+        const std::string name = dirEntry.path().filename().string();
+
+        if (name.starts_with("node") && name.size() > 4 && std::isdigit(name[4])) {
+            numNodes++;
+        }
+    }
+
+    return std::max<size_t>(numNodes, 1);
+}
+
+// -1 if unknown
+inline i64 numaNodeOfCpu(const size_t cpu) {
+    std::error_code errorCode;
+
+    const std::string cpuDir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+
+    for (const auto& dirEntry : std::filesystem::directory_iterator(cpuDir, errorCode)) {
+        const std::string name = dirEntry.path().filename().string();
+
+        if (name.starts_with("node") && name.size() > 4 && std::isdigit(name[4])) {
+            return std::stoll(name.substr(4));
+        }
+    }
+
+    return -1;
+}
+
+// Empty if unknown
+inline std::vector<size_t> numaNodeCpus(const i64 numaNode) {
+    std::ifstream cpuListFile("/sys/devices/system/node/node" + std::to_string(numaNode) +
+                              "/cpulist");
+
+    std::string cpuList;
+    std::getline(cpuListFile, cpuList);
+
+    return parseCpuList(cpuList);
+}
+
+// Restricts the calling thread to the given cores
+// Returns false if unsupported or it failed
+inline bool pinThisThread([[maybe_unused]] const std::vector<size_t>& cpus) {
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+
+    for (const size_t cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpuSet);
+        }
+    }
+
+    return !cpus.empty() && sched_setaffinity(0, sizeof(cpuSet), &cpuSet) == 0;
+#else
+    return false;
+#endif
+}
+
+// Memory the calling thread touches 1st goes on numaNode if it has free memory,
+// or back to the default (the node of the core touching it) if numaNode < 0
+// This is mbind() for all future allocations of the thread instead of 1 range
+// Returns false if unsupported or it failed
+inline bool preferNumaNode([[maybe_unused]] const i64 numaNode) {
+#ifdef __linux__
+    if (numaNode < 0) {
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT_POLICY, nullptr, 0) == 0;
+    }
+
+    if (static_cast<size_t>(numaNode) >= MAX_NUMA_NODES) {
+        return false;
+    }
+
+    constexpr size_t BITS = 8 * sizeof(unsigned long);
+    const size_t node = static_cast<size_t>(numaNode);
+
+    std::vector<unsigned long> nodeMask(MAX_NUMA_NODES / BITS, 0);
+    nodeMask[node / BITS] |= 1UL << (node % BITS);
+
+    // The kernel reads maxnode - 1 bits
+    return syscall(
+               SYS_set_mempolicy, MPOL_PREFERRED_POLICY, nodeMask.data(), MAX_NUMA_NODES + 1) == 0;
+#else
+    return false;
+#endif
+}
+
+// Pins worker threads to 1 core each, in order, from cpuList (Linux cpulist format)
+// or from all cores the process may run on if cpuList is empty,
+// so with cores listed node by node, a worker and its helpers usually share a NUMA node
+// Returns unpinned placements if pinning is unsupported
+inline std::vector<WorkerPlacement> placeWorkers(const size_t numWorkers,
+                                                 const size_t threadsPerWorker,
+                                                 const std::string& cpuList) {
+    std::vector<WorkerPlacement> placements(numWorkers);
+
+#ifdef __linux__
+    const std::vector<size_t> cpus = cpuList.empty() ? allowedCpus() : parseCpuList(cpuList);
+    assert(!cpus.empty());
+
+    const bool isNuma = numNumaNodes() > 1;
+
+    for (size_t i = 0; i < numWorkers; i++) {
+        for (size_t j = 0; j < threadsPerWorker; j++) {
+            placements[i].cpus.push_back(cpus[(i * threadsPerWorker + j) % cpus.size()]);
+        }
+
+        placements[i].numaNode = isNuma ? numaNodeOfCpu(placements[i].cpus[0]) : -1;
+    }
+
+    std::println("Dataloader: pinned {} threads to {} cores{}",
+                 numWorkers * threadsPerWorker,
+                 cpus.size(),
+                 isNuma ? ", workers' memory on their cores' NUMA nodes" : "");
+
+    if (numWorkers * threadsPerWorker > cpus.size()) {
+        std::println("Dataloader: more threads than cores to pin to, some cores have several");
+    }
+#else
+    std::println("Dataloader: thread pinning is Linux only, threads aren't pinned");
+#endif
+
+    return placements;
+}
@@ -1,5 +1,15 @@
 #pragma once
 
+#include <cassert>
+#include <cstdlib>
+#include <utility>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
 #include "../utils.hpp"
 
 constexpr size_t MAX_PIECES_PER_POS = 32;
@@ -8,35 +18,150 @@ constexpr size_t MAX_PIECES_PER_POS = 32;
 // Must match the MAX_MOVES_PER_POS in python/settings.py
 constexpr size_t MAX_MOVES_PER_POS = 64;
 
+// Every array of a batch starts at a multiple of this in the batch's arena
+constexpr size_t BATCH_ARENA_ALIGNMENT = 64;
+
+// Transparent huge pages only back 2 MB aligned 2 MB ranges
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
 // A batch of N data entries (1 data entry = 1 position)
+// All arrays are carved from a single allocation (the arena), so a batch is 1 contiguous region
+// Arrays have the dtypes the trainer consumes (int32 indices, float32 values, int64 class index),
+// so it copies a batch to the GPU in 1 copy of the arena and views each array in the copy
+// Must match the Batch class in python/batch.py
 struct Batch {
    public:
     // [entryIdx][MAX_PIECES_PER_POS] arrays padded with -1
-    i16* activeFeaturesStm;
-    i16* activeFeaturesNtm;
+    // In CSR layout, the features of every entry are instead consecutive (no padding),
+    // those of entry i being [featureOffsets[i], featureOffsets[i + 1])
+    i32* activeFeaturesStm;
+    i32* activeFeaturesNtm;
 
     // [entryIdx] arrays
-    i16* stmScores;
+    float* stmScores;
     float* stmResults;
 
     // [entryIdx][MAX_MOVES_PER_POS] array padded with -1
-    i16* legalMovesIdxs;
+    i32* legalMovesIdxs;
+
+    // [entryIdx] array, the index of the best move in legalMovesIdxs (policy target class)
+    i64* bestMoveIdx;
+
+    // Memory of all arrays above and below
+    u8* arena = nullptr;
+    size_t arenaSizeBytes = 0;
+
+    // Bytes at the start of the arena that hold the arrays (the rest is padding)
+    size_t dataSizeBytes = 0;
 
-    // [entryIdx] array
-    u8* bestMoveIdx;
+    // Only filled in CSR layout
+    // [entryIdx + 1] array, with featureOffsets[batchSize] = numActiveFeatures
+    i32* featureOffsets;
+    size_t numActiveFeatures = 0;
 
     constexpr Batch() {}
 
-    constexpr Batch(const std::size_t batchSize) {
-        this->activeFeaturesStm = new i16[batchSize * MAX_PIECES_PER_POS];
-        this->activeFeaturesNtm = new i16[batchSize * MAX_PIECES_PER_POS];
+    // If useHugePages, an arena of at least HUGE_PAGE_SIZE asks for transparent huge pages
+    constexpr Batch(const std::size_t batchSize, const bool useHugePages) {
+        size_t offsetBytes = 0;
+
+        // Returns the offset of an array of numBytes in the arena
+        const auto carve = [&](const size_t numBytes) -> size_t {
+            const size_t arrayOffsetBytes = offsetBytes;
+            offsetBytes = roundUp(offsetBytes + numBytes, BATCH_ARENA_ALIGNMENT);
+            return arrayOffsetBytes;
+        };
+
+        const size_t featuresStmOffset = carve(batchSize * MAX_PIECES_PER_POS * sizeof(i32));
+        const size_t featuresNtmOffset = carve(batchSize * MAX_PIECES_PER_POS * sizeof(i32));
+        const size_t stmScoresOffset = carve(batchSize * sizeof(float));
+        const size_t stmResultsOffset = carve(batchSize * sizeof(float));
+        const size_t legalMovesIdxsOffset = carve(batchSize * MAX_MOVES_PER_POS * sizeof(i32));
+        const size_t bestMoveIdxOffset = carve(batchSize * sizeof(i64));
+        const size_t featureOffsetsOffset = carve((batchSize + 1) * sizeof(i32));
+
+        dataSizeBytes = offsetBytes;
+
+        const bool hugePages = useHugePages && offsetBytes >= HUGE_PAGE_SIZE;
+        const size_t alignment = hugePages ? HUGE_PAGE_SIZE : BATCH_ARENA_ALIGNMENT;
+
+        // Aligned allocations must be a multiple of their alignment
+        arenaSizeBytes = roundUp(offsetBytes, alignment);
+
+#ifdef _WIN32
+        arena = static_cast<u8*>(_aligned_malloc(arenaSizeBytes, alignment));
+#else
+        arena = static_cast<u8*>(std::aligned_alloc(alignment, arenaSizeBytes));
 
-        this->stmScores = new i16[batchSize];
-        this->stmResults = new float[batchSize];
+        // Fewer TLB misses while decoding into the batch and copying it
+        if (hugePages) {
+            madvise(arena, arenaSizeBytes, MADV_HUGEPAGE);
+        }
+#endif
 
-        this->legalMovesIdxs = new i16[batchSize * MAX_MOVES_PER_POS];
+        assert(arena != nullptr);
+
+        activeFeaturesStm = reinterpret_cast<i32*>(arena + featuresStmOffset);
+        activeFeaturesNtm = reinterpret_cast<i32*>(arena + featuresNtmOffset);
+        stmScores = reinterpret_cast<float*>(arena + stmScoresOffset);
+        stmResults = reinterpret_cast<float*>(arena + stmResultsOffset);
+        legalMovesIdxs = reinterpret_cast<i32*>(arena + legalMovesIdxsOffset);
+        bestMoveIdx = reinterpret_cast<i64*>(arena + bestMoveIdxOffset);
+        featureOffsets = reinterpret_cast<i32*>(arena + featureOffsetsOffset);
+    }
+
+    // A batch owns its arena
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+    Batch& operator=(Batch&&) = delete;
+
+    constexpr Batch(Batch&& other) noexcept {
+        activeFeaturesStm = other.activeFeaturesStm;
+        activeFeaturesNtm = other.activeFeaturesNtm;
+        stmScores = other.stmScores;
+        stmResults = other.stmResults;
+        legalMovesIdxs = other.legalMovesIdxs;
+        bestMoveIdx = other.bestMoveIdx;
+        arena = std::exchange(other.arena, nullptr);
+        arenaSizeBytes = std::exchange(other.arenaSizeBytes, 0);
+        dataSizeBytes = other.dataSizeBytes;
+        featureOffsets = other.featureOffsets;
+        numActiveFeatures = other.numActiveFeatures;
+    }
+
+    // Turns the padded features of the first batchSize entries into CSR layout, in place
+    constexpr void compactFeatures(const size_t batchSize) {
+        size_t numFeatures = 0;
+
+        for (size_t entryIdx = 0; entryIdx < batchSize; entryIdx++) {
+            featureOffsets[entryIdx] = static_cast<i32>(numFeatures);
+
+            const size_t paddedIdx = entryIdx * MAX_PIECES_PER_POS;
+
+            // Never writes past what's still to be read, as numFeatures <= paddedIdx
+            for (size_t i = 0; i < MAX_PIECES_PER_POS && activeFeaturesStm[paddedIdx + i] != -1;
+                 i++) {
+                activeFeaturesStm[numFeatures] = activeFeaturesStm[paddedIdx + i];
+                activeFeaturesNtm[numFeatures] = activeFeaturesNtm[paddedIdx + i];
+                numFeatures++;
+            }
+        }
+
+        featureOffsets[batchSize] = static_cast<i32>(numFeatures);
+        numActiveFeatures = numFeatures;
+    }
+
+    constexpr ~Batch() {
+#ifdef _WIN32
+        _aligned_free(arena);
+#else
+        std::free(arena);
+#endif
+    }
 
-        this->bestMoveIdx = new u8[batchSize];
+   private:
+    static constexpr size_t roundUp(const size_t value, const size_t multiple) {
+        return (value + multiple - 1) / multiple * multiple;
     }
 
 };  // struct Batch
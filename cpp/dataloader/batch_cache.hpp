@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "../utils.hpp"
+#include "batch.hpp"
+
+// Decoded batches kept in RAM within a memory budget, so later epochs copy them
+// instead of reading, decoding and generating legal moves again
+// Batch number i of the 1st epoch is cached in slot i (see Shuffler::replayedBatchNum())
+// Batches are stored without padding and in narrower types than Batch's, each entry as:
+//     u8 number of active features n, u8 number of legal moves m
+//     i16 stm features[n], i16 ntm features[n], i16 legal moves' policy indices[m]
+//     i16 stm score, u8 stm result * 2, u8 best move index
+class BatchCache {
+   private:
+    enum SlotState : u8 { EMPTY, STORING, CACHED, OVER_BUDGET };
+
+    struct Slot {
+       public:
+        std::atomic<SlotState> mState = EMPTY;
+        std::vector<u8> mBytes;
+    };
+
+    std::unique_ptr<Slot[]> mSlots;
+    size_t mNumSlots;
+    size_t mBatchSize;
+
+    u64 mBudgetBytes;
+    std::atomic<u64> mUsedBytes = 0;
+
+   public:
+    constexpr BatchCache(const size_t numSlots, const size_t batchSize, const u64 budgetBytes) {
+        assert(numSlots > 0 && batchSize > 0);
+
+        mSlots = std::make_unique<Slot[]>(numSlots);
+        mNumSlots = numSlots;
+        mBatchSize = batchSize;
+        mBudgetBytes = budgetBytes;
+    }
+
+    constexpr u64 usedBytes() const { return mUsedBytes.load(std::memory_order_relaxed); }
+
+    // If batch batchNum is cached, fills batch with it (padded layout) and returns true
+    // Thread-safe
+    constexpr bool load(const u64 batchNum, Batch& batch) const {
+        assert(batchNum < mNumSlots);
+
+        const Slot& slot = mSlots[batchNum];
+
+        if (slot.mState.load(std::memory_order_acquire) != CACHED) {
+            return false;
+        }
+
+        std::fill(batch.activeFeaturesStm,
+                  batch.activeFeaturesStm + mBatchSize * MAX_PIECES_PER_POS,
+                  -1);
+
+        std::fill(batch.activeFeaturesNtm,
+                  batch.activeFeaturesNtm + mBatchSize * MAX_PIECES_PER_POS,
+                  -1);
+
+        std::fill(batch.legalMovesIdxs,
+                  batch.legalMovesIdxs + mBatchSize * MAX_MOVES_PER_POS,
+                  -1);
+
+        const u8* bytes = slot.mBytes.data();
+
+        const auto readI16 = [&]() -> i16 {
+            i16 value;
+            std::memcpy(&value, bytes, sizeof(i16));
+            bytes += sizeof(i16);
+            return value;
+        };
+
+        const auto readArray = [&](i32* array, const size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                array[i] = readI16();
+            }
+        };
+
+        for (size_t entryIdx = 0; entryIdx < mBatchSize; entryIdx++) {
+            const u8 numFeatures = *bytes++;
+            const u8 numMoves = *bytes++;
+
+            readArray(batch.activeFeaturesStm + entryIdx * MAX_PIECES_PER_POS, numFeatures);
+            readArray(batch.activeFeaturesNtm + entryIdx * MAX_PIECES_PER_POS, numFeatures);
+            readArray(batch.legalMovesIdxs + entryIdx * MAX_MOVES_PER_POS, numMoves);
+
+            batch.stmScores[entryIdx] = static_cast<float>(readI16());
+            batch.stmResults[entryIdx] = static_cast<float>(*bytes++) / 2.0f;
+            batch.bestMoveIdx[entryIdx] = *bytes++;
+        }
+
+        assert(bytes == slot.mBytes.data() + slot.mBytes.size());
+
+        return true;
+    }
+
+    // Caches batch (padded layout) as batch batchNum, unless it's already cached,
+    // being cached by another thread or doesn't fit in the budget
+    // Thread-safe
+    constexpr void store(const u64 batchNum, const Batch& batch) {
+        assert(batchNum < mNumSlots);
+
+        Slot& slot = mSlots[batchNum];
+
+        if (mUsedBytes.load(std::memory_order_relaxed) >= mBudgetBytes) {
+            return;
+        }
+
+        SlotState expected = EMPTY;
+
+        if (!slot.mState.compare_exchange_strong(expected, STORING, std::memory_order_relaxed)) {
+            return;
+        }
+
+        std::vector<u8> bytes;
+        bytes.reserve(mBatchSize * 128);
+
+        const auto writeI16 = [&](const i16 value) {
+            const size_t size = bytes.size();
+            bytes.resize(size + sizeof(i16));
+            std::memcpy(bytes.data() + size, &value, sizeof(i16));
+        };
+
+        // Features and policy indices fit in an i16
+        const auto writeArray = [&](const i32* array, const size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                writeI16(static_cast<i16>(array[i]));
+            }
+        };
+
+        for (size_t entryIdx = 0; entryIdx < mBatchSize; entryIdx++) {
+            const i32* featuresStm = batch.activeFeaturesStm + entryIdx * MAX_PIECES_PER_POS;
+            const i32* featuresNtm = batch.activeFeaturesNtm + entryIdx * MAX_PIECES_PER_POS;
+            const i32* legalMovesIdxs = batch.legalMovesIdxs + entryIdx * MAX_MOVES_PER_POS;
+
+            const size_t numFeatures = static_cast<size_t>(
+                std::find(featuresStm, featuresStm + MAX_PIECES_PER_POS, -1) - featuresStm);
+
+            const size_t numMoves = static_cast<size_t>(
+                std::find(legalMovesIdxs, legalMovesIdxs + MAX_MOVES_PER_POS, -1) -
+                legalMovesIdxs);
+
+            bytes.push_back(static_cast<u8>(numFeatures));
+            bytes.push_back(static_cast<u8>(numMoves));
+
+            writeArray(featuresStm, numFeatures);
+            writeArray(featuresNtm, numFeatures);
+            writeArray(legalMovesIdxs, numMoves);
+            writeI16(static_cast<i16>(batch.stmScores[entryIdx]));
+
+            bytes.push_back(static_cast<u8>(batch.stmResults[entryIdx] * 2.0f));
+            bytes.push_back(static_cast<u8>(batch.bestMoveIdx[entryIdx]));
+        }
+
+        bytes.shrink_to_fit();
+
+        const u64 usedBytes = mUsedBytes.fetch_add(bytes.size(), std::memory_order_relaxed);
+
+        if (usedBytes + bytes.size() > mBudgetBytes) {
+            mUsedBytes.fetch_sub(bytes.size(), std::memory_order_relaxed);
+            slot.mState.store(OVER_BUDGET, std::memory_order_relaxed);
+            return;
+        }
+
+        slot.mBytes = std::move(bytes);
+        slot.mState.store(CACHED, std::memory_order_release);
+    }
+
+};  // class BatchCache
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "../utils.hpp"
+#include "batch.hpp"
+#include "served_batches.hpp"
+
+// A decoded batch and its number in the order batches are claimed by workers
+struct ReadyBatch {
+   public:
+    u64 batchNum;
+    Batch* batch;
+
+    // [sourceIdx] entries of each data source decoded into the batch
+    // Owned by the worker, valid until the batch is released
+    const u64* entriesPerSource;
+
+    // Batch numbers the worker claimed before this one and skipped, as the entry filter
+    // kept too few entries to fill them (see Worker::loadFilteredEntries())
+    // Owned by the worker, valid until the batch is released
+    const u64* skippedBatchNums;
+    size_t numSkipped;
+};
+
+// Lock-free queue of decoded batches
+// Multiple producers (workers) push, a single consumer (next_batch()) pops
+// Bounded ring of cells with sequence numbers (Dmitry Vyukov's bounded queue)
+// Never full as long as its capacity is at least the total number of batches workers own
+class BatchQueue {
+   private:
+    struct Cell {
+       public:
+        std::atomic<u64> mSequence;
+        ReadyBatch mReadyBatch;
+    };
+
+    std::unique_ptr<Cell[]> mCells;
+    u64 mMask;
+
+    alignas(64) std::atomic<u64> mEnqueuePos = 0;
+
+    // Consumer only
+    alignas(64) u64 mDequeuePos = 0;
+
+    // Incremented after every push, so the consumer can sleep on it with atomic wait()
+    alignas(64) std::atomic<u64> mPushes = 0;
+
+    // Consumer only
+    // If deterministic, batches are served in batch number order instead of as soon as decoded,
+    // and the ones that were decoded early wait here
+    // Batch numbers served before resuming are skipped (workers never decode them),
+    // and so are the ones workers skipped (see ReadyBatch.skippedBatchNums)
+    bool mDeterministic;
+    const ServedBatches* mServedBeforeResume;
+    u64 mNextBatchNumToServe = 0;
+    std::vector<ReadyBatch> mEarlyBatches;
+    std::set<u64> mSkippedBatchNums;
+
+   public:
+    constexpr BatchQueue(const size_t minCapacity,
+                         const bool deterministic,
+                         const ServedBatches& servedBeforeResume) {
+        const u64 capacity = std::bit_ceil(std::max<u64>(minCapacity, 2));
+
+        mCells = std::make_unique<Cell[]>(capacity);
+        mMask = capacity - 1;
+
+        for (u64 i = 0; i < capacity; i++) {
+            mCells[i].mSequence.store(i, std::memory_order_relaxed);
+        }
+
+        mDeterministic = deterministic;
+        mServedBeforeResume = &servedBeforeResume;
+        mNextBatchNumToServe = nextServableBatchNum(servedBeforeResume.watermark());
+    }
+
+    // Called by workers
+    constexpr void push(const ReadyBatch readyBatch) {
+        u64 pos = mEnqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        while (true) {
+            cell = &mCells[pos & mMask];
+
+            const u64 sequence = cell->mSequence.load(std::memory_order_acquire);
+            const i64 diff = static_cast<i64>(sequence) - static_cast<i64>(pos);
+
+            // Queue full
+            assert(diff >= 0);
+
+            if (diff == 0 && mEnqueuePos.compare_exchange_weak(
+                                 pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+
+            if (diff != 0) {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->mReadyBatch = readyBatch;
+        cell->mSequence.store(pos + 1, std::memory_order_release);
+
+        mPushes.fetch_add(1, std::memory_order_release);
+        mPushes.notify_one();
+    }
+
+    // Called by the consumer
+    // Blocks until the next batch to serve is decoded
+    constexpr ReadyBatch pop() {
+        if (!mDeterministic) {
+            return popAny();
+        }
+
+        while (true) {
+            const auto it = std::find_if(
+                mEarlyBatches.begin(), mEarlyBatches.end(), [this](const ReadyBatch& readyBatch) {
+                    return readyBatch.batchNum == mNextBatchNumToServe;
+                });
+
+            if (it != mEarlyBatches.end()) {
+                const ReadyBatch readyBatch = *it;
+                mEarlyBatches.erase(it);
+                mNextBatchNumToServe = nextServableBatchNum(mNextBatchNumToServe + 1);
+                return readyBatch;
+            }
+
+            const ReadyBatch readyBatch = popAny();
+            mEarlyBatches.push_back(readyBatch);
+
+            mSkippedBatchNums.insert(readyBatch.skippedBatchNums,
+                                     readyBatch.skippedBatchNums + readyBatch.numSkipped);
+
+            mNextBatchNumToServe = nextServableBatchNum(mNextBatchNumToServe);
+        }
+    }
+
+   private:
+    constexpr u64 nextServableBatchNum(u64 batchNum) {
+        while (mServedBeforeResume->contains(batchNum) || mSkippedBatchNums.erase(batchNum) > 0) {
+            batchNum++;
+        }
+
+        return batchNum;
+    }
+
+    constexpr ReadyBatch popAny() {
+        while (true) {
+            const u64 pushes = mPushes.load(std::memory_order_acquire);
+
+            Cell& cell = mCells[mDequeuePos & mMask];
+            const u64 sequence = cell.mSequence.load(std::memory_order_acquire);
+
+            if (sequence == mDequeuePos + 1) {
+                const ReadyBatch readyBatch = cell.mReadyBatch;
+                cell.mSequence.store(mDequeuePos + mMask + 1, std::memory_order_release);
+                mDequeuePos++;
+                return readyBatch;
+            }
+
+            // Empty, sleep until a worker pushes
+            mPushes.wait(pushes, std::memory_order_acquire);
+        }
+    }
+
+};  // class BatchQueue
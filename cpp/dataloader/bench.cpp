@@ -0,0 +1,256 @@
+// Dataloader throughput benchmark, no PyTorch or GPU needed
+// Serves batches from a data file for every combination of thread count and batch size given
+// Linked with dataloader.cpp, built with DATALOADER_NO_MAIN (see make dataloader-bench)
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <print>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "../utils.hpp"
+#include "batch.hpp"
+#include "dataloader.hpp"
+#include "options.hpp"
+#include "stats.hpp"
+
+// Peak resident memory of this process so far, in MB
+u64 peakRssMB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return static_cast<u64>(counters.PeakWorkingSetSize) / (1024 * 1024);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<u64>(usage.ru_maxrss) / 1024;  // Linux reports KB
+#endif
+}
+
+// FNV-1a
+constexpr u64 hashBytes(u64 hash, const void* data, const size_t numBytes) {
+    const auto* bytes = static_cast<const u8*>(data);
+
+    for (size_t i = 0; i < numBytes; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// Hash of all of a batch's contents as served to the trainer: every array in its served dtype
+// (i32 features and legal moves, float scores and results, i64 best move index), with the -1
+// padding of the padded layout, or the CSR features and offsets
+// It guards that changes to how batches are read and decoded (threads, readers, SIMD, caches)
+// serve the same bytes for the same data file and settings. Changing the Batch arrays' dtypes
+// or layout changes every checksum, so only compare checksums of builds with the same Batch
+constexpr u64 hashBatch(u64 hash, const Batch& batch, const size_t batchSize, const bool csr) {
+    const size_t numFeatures = csr ? batch.numActiveFeatures : batchSize * MAX_PIECES_PER_POS;
+
+    hash = hashBytes(hash, batch.activeFeaturesStm, numFeatures * sizeof(i32));
+    hash = hashBytes(hash, batch.activeFeaturesNtm, numFeatures * sizeof(i32));
+
+    if (csr) {
+        hash = hashBytes(hash, batch.featureOffsets, (batchSize + 1) * sizeof(i32));
+    }
+
+    hash = hashBytes(hash, batch.stmScores, batchSize * sizeof(float));
+    hash = hashBytes(hash, batch.stmResults, batchSize * sizeof(float));
+    hash = hashBytes(hash, batch.legalMovesIdxs, batchSize * MAX_MOVES_PER_POS * sizeof(i32));
+    hash = hashBytes(hash, batch.bestMoveIdx, batchSize * sizeof(i64));
+
+    return hash;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::println(std::cerr,
+                     "Usage: {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {}",
+                     argv[0],
+                     "<data file>",
+                     "[--threads <comma-separated thread counts, default 1,2,4,8>]",
+                     "[--batch-sizes <comma-separated batch sizes, default 1024,16384>]",
+                     "[--batches <batches served per run, default 1000>]",
+                     "[--threads-per-batch <threads decoding each batch, default 1>]",
+                     "[--shuffle]",
+                     "[--no-mmap]",
+                     "[--csr]",
+                     "[--huge-pages]",
+                     "[--pin-threads [<cores in Linux cpulist format, default all>]]",
+                     "[--batch-cache-mb <MB of decoded batches to cache, default 0>]",
+                     "[--trust-stamped]",
+                     "[--filter-max-score <drop entries with a bigger abs(score)>]",
+                     "[--trace <Chrome trace JSON file of the last run>]",
+                     "[--feature-set <input feature set name, default starway>]");
+
+        return 1;
+    }
+
+    // Read program args
+
+    const std::string dataFilePath = argv[1];
+    std::vector<size_t> threadCounts = {1, 2, 4, 8};
+    std::vector<size_t> batchSizes = {1024, 16384};
+    size_t numBatches = 1000;
+
+    DataloaderOptions options = DataloaderOptions{.useMmap = true,
+                                                  .shuffle = false,
+                                                  .shuffleSeed = 42,
+                                                  .shuffleWindowBatches = 16,
+                                                  .prefetchBatches = 3,
+                                                  .deterministic = true,
+                                                  .threadsPerBatch = 1,
+                                                  .contiguousChunkBytes = 0,
+                                                  .useHugePages = false,
+                                                  .csrFeatures = false,
+                                                  .pinThreads = false,
+                                                  .cpuList = nullptr,
+                                                  .consumerNumaNode = -1,
+                                                  .batchCacheBytes = 0,
+                                                  .trustStampedData = false,
+                                                  .filterEntries = false,
+                                                  .filterMaxAbsScore = 32767,
+                                                  .filterResults = 0b111,
+                                                  .filterMinPieces = 0,
+                                                  .filterMaxPieces = 32,
+                                                  .filterInCheck = false,
+                                                  .filterMinLegalMoves = 0,
+                                                  .filterMaxLegalMoves = 255,
+                                                  .tracePath = nullptr,
+                                                  .rank = 0,
+                                                  .worldSize = 1,
+                                                  .featureSet = nullptr};
+
+    const auto parseList = [](const std::string& list) -> std::vector<size_t> {
+        std::vector<size_t> values;
+
+        for (const std::string& value : split(list, ',')) {
+            values.push_back(std::stoull(value));
+        }
+
+        return values;
+    };
+
+    for (int i = 2; i < argc; i++) {
+        const std::string arg = argv[i];
+
+        if (arg == "--threads" && i + 1 < argc) {
+            threadCounts = parseList(argv[++i]);
+        } else if (arg == "--batch-sizes" && i + 1 < argc) {
+            batchSizes = parseList(argv[++i]);
+        } else if (arg == "--batches" && i + 1 < argc) {
+            numBatches = std::stoull(argv[++i]);
+        } else if (arg == "--threads-per-batch" && i + 1 < argc) {
+            options.threadsPerBatch = std::stoull(argv[++i]);
+        } else if (arg == "--shuffle") {
+            options.shuffle = true;
+        } else if (arg == "--no-mmap") {
+            options.useMmap = false;
+        } else if (arg == "--csr") {
+            options.csrFeatures = true;
+        } else if (arg == "--huge-pages") {
+            options.useHugePages = true;
+        } else if (arg == "--batch-cache-mb" && i + 1 < argc) {
+            options.batchCacheBytes = std::stoull(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--trust-stamped") {
+            options.trustStampedData = true;
+        } else if (arg == "--filter-max-score" && i + 1 < argc) {
+            options.filterEntries = true;
+            options.filterMaxAbsScore = static_cast<u16>(std::stoull(argv[++i]));
+        } else if (arg == "--trace" && i + 1 < argc) {
+            options.tracePath = argv[++i];
+        } else if (arg == "--feature-set" && i + 1 < argc) {
+            options.featureSet = argv[++i];
+        } else if (arg == "--pin-threads") {
+            options.pinThreads = true;
+
+            if (i + 1 < argc && !std::string(argv[i + 1]).starts_with("--")) {
+                options.cpuList = argv[++i];
+            }
+        } else {
+            std::println(std::cerr, "Unknown or incomplete arg: {}", arg);
+            return 1;
+        }
+    }
+
+    assert(numBatches > 0);
+
+    std::println("Data file: {}", dataFilePath);
+    std::println("Batches served per run: {}", numBatches);
+    std::println("Threads per batch: {}", options.threadsPerBatch);
+    std::println("Shuffle: {}", options.shuffle);
+    std::println("Memory-map data file: {}", options.useMmap);
+    std::println("CSR features: {}", options.csrFeatures);
+    std::println("Huge pages: {}", options.useHugePages);
+    std::println("Pin threads: {}", options.pinThreads);
+    std::println("Batch cache: {} MB", options.batchCacheBytes / (1024 * 1024));
+    std::println("Trust stamped data: {}", options.trustStampedData);
+
+    if (options.filterEntries) {
+        std::println("Filter: drop entries with abs(score) > {}", options.filterMaxAbsScore);
+    }
+
+    // Batches are served in deterministic order, so a run's checksum (see hashBatch()) only depends
+    // on the data file, batch size, batches served and the settings that change a batch's entries
+    // (shuffle, filter, feature set), not on the thread count
+    // Compare checksums before and after changing the decoding to check it's still byte-identical
+    std::println("Peak RSS is of the whole process so far, not of each run");
+    std::println();
+
+    for (const size_t batchSize : batchSizes) {
+        for (const size_t numThreads : threadCounts) {
+            init(dataFilePath.c_str(), batchSize, numThreads, &options);
+
+            std::vector<u64> latenciesNs;
+            latenciesNs.reserve(numBatches);
+
+            u64 checksum = 14695981039346656037ULL;
+
+            const auto start = std::chrono::steady_clock::now();
+
+            for (size_t i = 0; i < numBatches; i++) {
+                const auto batchStart = std::chrono::steady_clock::now();
+                Batch* batch = next_batch(batchSize);
+                latenciesNs.push_back(nanosecondsSince(batchStart));
+
+                checksum = hashBatch(checksum, *batch, batchSize, options.csrFeatures);
+                release_batch(batch);
+            }
+
+            const double secs = static_cast<double>(nanosecondsSince(start)) / 1e9;
+
+            shutdown();
+
+            std::sort(latenciesNs.begin(), latenciesNs.end());
+
+            const auto percentileMs = [&](const size_t percentile) -> double {
+                const size_t idx = (latenciesNs.size() - 1) * percentile / 100;
+                return static_cast<double>(latenciesNs[idx]) / 1e6;
+            };
+
+            const double positionsPerSec = static_cast<double>(numBatches * batchSize) / secs;
+
+            std::println(
+                "Batch size {:>6}, threads {:>3}: {:>10.0f} positions/s, batch latency p50 "
+                "{:>8.3f} ms, p99 {:>8.3f} ms, peak RSS {:>6} MB, checksum {:016x}",
+                batchSize,
+                numThreads,
+                positionsPerSec,
+                percentileMs(50),
+                percentileMs(99),
+                peakRssMB(),
+                checksum);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <optional>
+#include <vector>
+
+#include "../utils.hpp"
+#include "data_file.hpp"
+
+// A worker's own contiguous range of batch-sized blocks of the data file
+// The range is read front to back in chunks of consecutive blocks, 1 large read per chunk,
+// into a private buffer, so each worker is a single sequential stream for the kernel's readahead
+class ChunkedRange {
+   private:
+    const DataFile* mDataFile;
+    size_t mBlockSizeBytes;
+    size_t mBatchSize;
+
+    size_t mFirstBlock;
+    size_t mNumBlocks;
+    size_t mChunkBlocks;
+
+    DataFileReader mReader;
+    std::vector<char> mBuffer;
+    std::optional<size_t> mLoadedChunk = std::nullopt;
+
+   public:
+    ChunkedRange(const DataFile& dataFile,
+                 const size_t batchSize,
+                 const size_t firstBlock,
+                 const size_t numBlocks,
+                 const size_t chunkBytes) {
+        assert(numBlocks > 0);
+        assert((firstBlock + numBlocks) * batchSize <= dataFile.numEntries());
+
+        mDataFile = &dataFile;
+        mBlockSizeBytes = batchSize * dataFile.entrySizeBytes();
+        mBatchSize = batchSize;
+        mFirstBlock = firstBlock;
+        mNumBlocks = numBlocks;
+        mChunkBlocks = std::clamp<size_t>(chunkBytes / mBlockSizeBytes, 1, numBlocks);
+
+        mReader = DataFileReader(dataFile, 1);
+
+        mBuffer.resize(mChunkBlocks * mBlockSizeBytes);
+    }
+
+    constexpr size_t numBlocks() const { return mNumBlocks; }
+
+    constexpr size_t chunkBlocks() const { return mChunkBlocks; }
+
+    // Fills blocks with the entries (bytes) of each block of the chunkIdx-th chunk of the range,
+    // reading the chunk unless it's the one already in the buffer
+    // Returns the number of blocks in that chunk (the last chunk may be smaller)
+    constexpr size_t loadChunk(const size_t chunkIdx, const char** blocks) {
+        const size_t firstBlock = chunkIdx * mChunkBlocks;
+        assert(firstBlock < mNumBlocks);
+
+        const size_t numBlocks = std::min(mChunkBlocks, mNumBlocks - firstBlock);
+
+        if (mLoadedChunk != chunkIdx) {
+            mReader.readEntries(
+                (mFirstBlock + firstBlock) * mBatchSize, numBlocks * mBatchSize, mBuffer.data());
+
+            mLoadedChunk = chunkIdx;
+        }
+
+        for (size_t i = 0; i < numBlocks; i++) {
+            blocks[i] = mBuffer.data() + i * mBlockSizeBytes;
+        }
+
+        return numBlocks;
+    }
+
+};  // class ChunkedRange
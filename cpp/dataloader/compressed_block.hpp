@@ -0,0 +1,206 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "../chess/util.hpp"
+#include "../converter/data_entry.hpp"
+#include "../utils.hpp"
+
+// First 4 bytes of a compressed data file ("STWC" when read as chars)
+// Like FEATURIZED_MAGIC, it has bits set that a StarwayDataEntry.mMiscData never has
+constexpr u32 COMPRESSED_MAGIC = 0x43575453;
+
+constexpr u32 COMPRESSED_VERSION = 1;
+
+// Compressed data file = CompressedFileHeader, then blocks of mBlockEntries data entries
+// (the last block may have fewer) each compressed on its own, then the block index:
+// the u64 byte offset of every block followed by mIndexOffset,
+// so block i is bytes [index[i], index[i + 1]) of the file
+struct CompressedFileHeader {
+   public:
+    u32 mMagic;
+    u32 mVersion;
+    u64 mNumEntries;
+    u64 mBlockEntries;
+    u64 mIndexOffset;
+
+};  // struct CompressedFileHeader
+
+static_assert(sizeof(CompressedFileHeader) == 32);  // 32 bytes
+
+static_assert((COMPRESSED_MAGIC & static_cast<u32>(Mask::NEVER_SET)) != 0);
+
+// Block codec
+// Consecutive data entries are usually consecutive positions of a game, so each entry is stored
+// as its changes from the previous entry of the block (the 1st one from an empty board):
+//     u32 mMiscData
+//     u8 number of changed squares, then u16 per changed square (square | (piece code << 6))
+//     LEB128 of the zigzagged change of the white POV score
+//     u16 mBestMove
+// Squares and piece colors are white POV (not oriented), so a quiet move changes 2 squares
+// A piece code is 0 for an empty square, else 1 + (color | (pieceType << 1))
+struct BlockCodecState {
+   public:
+    std::array<u8, 64> mPieceCodes = {};
+    u64 mOccupied = 0;
+    u16 mWhiteScore = 0;
+
+};  // struct BlockCodecState
+
+// Appends the compressed bytes of `count` data entries to `bytes`
+constexpr void compressBlock(const StarwayDataEntry* entries,
+                             const size_t count,
+                             std::vector<u8>& bytes) {
+    const auto writeBytes = [&](const auto value) {
+        const size_t size = bytes.size();
+        bytes.resize(size + sizeof(value));
+        std::memcpy(bytes.data() + size, &value, sizeof(value));
+    };
+
+    BlockCodecState state;
+
+    for (size_t i = 0; i < count; i++) {
+        const StarwayDataEntry& entry = entries[i];
+
+        const bool blackStm = entry.get(Mask::STM);
+        const u8 sqXor = blackStm ? 56 : 0;
+
+        // Un-orient the entry's pieces
+        std::array<u8, 64> pieceCodes = {};
+        u64 occupied = entry.mOccupied;
+        u128 pieces = entry.mPieces;
+
+        while (occupied > 0) {
+            const u8 sq = static_cast<u8>(popLsb(occupied));
+            const u8 piece = static_cast<u8>((pieces & 0b1111) ^ blackStm);
+
+            pieceCodes[sq ^ sqXor] = static_cast<u8>(piece + 1);
+            pieces >>= 4;
+        }
+
+        writeBytes(static_cast<u32>(entry.mMiscData));
+
+        const size_t numChangesPos = bytes.size();
+        u8 numChanges = 0;
+        bytes.push_back(0);
+
+        for (u8 sq = 0; sq < 64; sq++) {
+            if (pieceCodes[sq] != state.mPieceCodes[sq]) {
+                writeBytes(static_cast<u16>(sq | (pieceCodes[sq] << 6)));
+                numChanges++;
+            }
+        }
+
+        bytes[numChangesPos] = numChanges;
+        state.mPieceCodes = pieceCodes;
+
+        // The stm score flips sign every ply, the white POV one changes little
+        // u16 math so negating -32768 round trips
+        const u16 stmScore = static_cast<u16>(entry.mStmScore);
+        const u16 whiteScore = blackStm ? static_cast<u16>(-stmScore) : stmScore;
+        const i32 scoreChange =
+            static_cast<i16>(whiteScore) - static_cast<i16>(state.mWhiteScore);
+        u32 zigzag = static_cast<u32>((scoreChange << 1) ^ (scoreChange >> 31));
+
+        do {
+            const u8 low7 = zigzag & 0x7F;
+            zigzag >>= 7;
+            bytes.push_back(zigzag > 0 ? static_cast<u8>(low7 | 0x80) : low7);
+        } while (zigzag > 0);
+
+        state.mWhiteScore = whiteScore;
+
+        writeBytes(static_cast<u16>(entry.mBestMove));
+    }
+}
+
+// Decompresses the `count` data entries of a block compressed by compressBlock()
+constexpr void decompressBlock(const u8* bytes,
+                               const size_t numBytes,
+                               const size_t count,
+                               StarwayDataEntry* entries) {
+    const u8* end = bytes + numBytes;
+
+    const auto readBytes = [&]<typename T>(T& value) {
+        assert(bytes + sizeof(T) <= end);
+        std::memcpy(&value, bytes, sizeof(T));
+        bytes += sizeof(T);
+    };
+
+    BlockCodecState state;
+
+    // StarwayDataEntry is packed, so its fields are read into locals first
+    for (size_t i = 0; i < count; i++) {
+        StarwayDataEntry& entry = entries[i];
+
+        u32 miscData;
+        readBytes(miscData);
+        entry.mMiscData = miscData;
+
+        assert(bytes < end);
+        const u8 numChanges = *bytes++;
+
+        for (u8 j = 0; j < numChanges; j++) {
+            u16 change;
+            readBytes(change);
+
+            const u8 sq = change & 0b111'111;
+            const u8 pieceCode = static_cast<u8>(change >> 6);
+            assert(pieceCode <= 12);
+
+            state.mPieceCodes[sq] = pieceCode;
+
+            if (pieceCode > 0) {
+                state.mOccupied |= 1ULL << sq;
+            } else {
+                state.mOccupied &= ~(1ULL << sq);
+            }
+        }
+
+        // Orient the pieces (ascending oriented square)
+        const bool blackStm = entry.get(Mask::STM);
+        const u8 sqXor = blackStm ? 56 : 0;
+
+        entry.mOccupied = blackStm ? std::byteswap(state.mOccupied) : state.mOccupied;
+        u64 occupied = entry.mOccupied;
+        u128 pieces = 0;
+
+        for (u32 shift = 0; occupied > 0; shift += 4) {
+            const u8 sq = static_cast<u8>(popLsb(occupied));
+            const u8 piece = static_cast<u8>((state.mPieceCodes[sq ^ sqXor] - 1) ^ blackStm);
+
+            pieces |= static_cast<u128>(piece) << shift;
+        }
+
+        entry.mPieces = pieces;
+
+        u32 zigzag = 0;
+
+        for (u32 shift = 0;; shift += 7) {
+            assert(bytes < end && shift < 32);
+
+            const u8 byte = *bytes++;
+            zigzag |= static_cast<u32>(byte & 0x7F) << shift;
+
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+
+        const i32 scoreChange = static_cast<i32>(zigzag >> 1) ^ -static_cast<i32>(zigzag & 1);
+        state.mWhiteScore = static_cast<u16>(state.mWhiteScore + scoreChange);
+
+        entry.mStmScore = static_cast<i16>(blackStm ? static_cast<u16>(-state.mWhiteScore)
+                                                    : state.mWhiteScore);
+
+        u16 bestMove;
+        readBytes(bestMove);
+        entry.mBestMove = bestMove;
+    }
+
+    assert(bytes == end);
+}
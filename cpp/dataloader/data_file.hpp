@@ -0,0 +1,498 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <print>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "../converter/data_entry.hpp"
+#include "../utils.hpp"
+#include "compressed_block.hpp"
+#include "data_stamp.hpp"
+#include "featurized_entry.hpp"
+
+// A Starway data file, a pre-featurized one or a compressed one,
+// opened once in init() and shared by all workers
+// If possible, the file is memory-mapped and workers decode straight out of the mapped pages
+// Otherwise (Windows or mmap() failed), each worker reads whole batches through its own ifstream
+// Workers read entries through their own DataFileReader
+class DataFile {
+   private:
+    std::string mPath;
+    size_t mFileSizeBytes = 0;
+
+    // Pre-featurized data files start with a FeaturizedFileHeader
+    bool mFeaturized = false;
+    size_t mHeaderSizeBytes = 0;
+    size_t mEntrySizeBytes = sizeof(StarwayDataEntry);
+
+    size_t mNumEntries = 0;
+
+    // Compressed data files start with a CompressedFileHeader
+    // Their entries are StarwayDataEntry's once decompressed
+    bool mCompressed = false;
+    size_t mBlockEntries = 0;
+    std::vector<u64> mBlockOffsets;
+
+    const char* mMapped = nullptr;
+
+    // Only set if the data file is trusted (see DataStampHeader)
+    // A block's CRC32C is checked by the 1st reader that reads it
+    size_t mStampBlockEntries = 0;
+    std::vector<u32> mBlockCrcs;
+    std::unique_ptr<std::atomic<bool>[]> mBlockVerified = nullptr;
+
+    friend class DataFileReader;
+
+   public:
+    DataFile(const std::string& path, const bool allowMmap) {
+        mPath = path;
+
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        assert(file);
+
+        const i64 fileSizeBytes = file.tellg();
+        assert(fileSizeBytes > 0);
+
+        mFileSizeBytes = static_cast<size_t>(fileSizeBytes);
+
+        // A Starway data file's first u32 is a StarwayDataEntry.mMiscData,
+        // which never equals FEATURIZED_MAGIC or COMPRESSED_MAGIC
+        u32 magic = 0;
+
+        if (mFileSizeBytes >= sizeof(magic)) {
+            file.seekg(0, std::ios::beg);
+            file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+            assert(file);
+        }
+
+        if (magic == FEATURIZED_MAGIC) {
+            FeaturizedFileHeader header;
+
+            file.seekg(0, std::ios::beg);
+            file.read(reinterpret_cast<char*>(&header), sizeof(header));
+            assert(file);
+
+            assert(header.mVersion == FEATURIZED_VERSION);
+            assert(header.mEntrySize == sizeof(FeaturizedEntry));
+
+            mFeaturized = true;
+            mHeaderSizeBytes = sizeof(FeaturizedFileHeader);
+            mEntrySizeBytes = sizeof(FeaturizedEntry);
+        }
+
+        if (magic == COMPRESSED_MAGIC) {
+            CompressedFileHeader header;
+
+            file.seekg(0, std::ios::beg);
+            file.read(reinterpret_cast<char*>(&header), sizeof(header));
+            assert(file);
+
+            assert(header.mVersion == COMPRESSED_VERSION);
+            assert(header.mBlockEntries > 0);
+
+            mCompressed = true;
+            mNumEntries = header.mNumEntries;
+            mBlockEntries = header.mBlockEntries;
+
+            // Read block index
+            const size_t numBlocks = (mNumEntries + mBlockEntries - 1) / mBlockEntries;
+            mBlockOffsets.resize(numBlocks + 1);
+
+            assert(header.mIndexOffset + mBlockOffsets.size() * sizeof(u64) == mFileSizeBytes);
+
+            file.seekg(static_cast<i64>(header.mIndexOffset), std::ios::beg);
+
+            file.read(reinterpret_cast<char*>(mBlockOffsets.data()),
+                      static_cast<i64>(mBlockOffsets.size() * sizeof(u64)));
+
+            assert(file);
+            assert(mBlockOffsets.back() == header.mIndexOffset);
+        } else {
+            // Assert file doesn't end in the middle of a data entry
+            assert((mFileSizeBytes - mHeaderSizeBytes) % mEntrySizeBytes == 0);
+
+            mNumEntries = (mFileSizeBytes - mHeaderSizeBytes) / mEntrySizeBytes;
+        }
+
+#ifndef _WIN32
+        if (!allowMmap) {
+            return;
+        }
+
+        const int fd = open(path.c_str(), O_RDONLY);
+        assert(fd != -1);
+
+        void* mapped = mmap(nullptr, mFileSizeBytes, PROT_READ, MAP_SHARED, fd, 0);
+
+        // The mapping stays valid after closing the file descriptor
+        close(fd);
+
+        if (mapped != MAP_FAILED) {
+            mMapped = static_cast<const char*>(mapped);
+        }
+#else
+        (void)allowMmap;
+#endif
+    }
+
+    ~DataFile() {
+#ifndef _WIN32
+        if (mMapped != nullptr) {
+            munmap(const_cast<char*>(mMapped), mFileSizeBytes);
+        }
+#endif
+    }
+
+    DataFile(const DataFile&) = delete;
+    DataFile& operator=(const DataFile&) = delete;
+
+    constexpr const std::string& path() const { return mPath; }
+
+    constexpr bool isFeaturized() const { return mFeaturized; }
+
+    constexpr size_t numEntries() const { return mNumEntries; }
+
+    // sizeof(StarwayDataEntry) or sizeof(FeaturizedEntry)
+    constexpr size_t entrySizeBytes() const { return mEntrySizeBytes; }
+
+    constexpr bool isMapped() const { return mMapped != nullptr; }
+
+    constexpr bool isCompressed() const { return mCompressed; }
+
+    // Entries are read straight out of the mapped pages, with no copy into a buffer
+    constexpr bool isZeroCopy() const { return isMapped() && !isCompressed(); }
+
+    // Data entries per compressed block (if compressed)
+    constexpr size_t blockEntries() const { return mBlockEntries; }
+
+    // Entries of a trusted data file don't need validating (see DataStampHeader)
+    constexpr bool isTrusted() const { return mBlockVerified != nullptr; }
+
+    // Loads the data file's stamp, if it has one that matches it, and then trusts the data file
+    // Returns whether the data file is now trusted
+    constexpr bool trust() {
+        std::ifstream stampFile(stampPath(mPath), std::ios::binary);
+
+        if (!stampFile) {
+            return false;
+        }
+
+        DataStampHeader header;
+        stampFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+        if (!stampFile || header.mMagic != DATA_STAMP_MAGIC ||
+            header.mVersion != DATA_STAMP_VERSION || header.mFileSizeBytes != mFileSizeBytes ||
+            header.mBlockEntries == 0 ||
+            (mCompressed && header.mBlockEntries != mBlockEntries) ||
+            header.mNumBlocks != (mNumEntries + header.mBlockEntries - 1) / header.mBlockEntries) {
+            return false;
+        }
+
+        mBlockCrcs.resize(header.mNumBlocks);
+
+        stampFile.read(reinterpret_cast<char*>(mBlockCrcs.data()),
+                       static_cast<i64>(mBlockCrcs.size() * sizeof(u32)));
+
+        if (!stampFile) {
+            mBlockCrcs.clear();
+            return false;
+        }
+
+        mStampBlockEntries = header.mBlockEntries;
+        mBlockVerified = std::make_unique<std::atomic<bool>[]>(mBlockCrcs.size());
+        return true;
+    }
+
+    // Byte offset and size of the bytes of the file holding block blockIdx, if the file is cut
+    // into blocks of blockEntries entries (a compressed file's own blocks if compressed)
+    constexpr std::pair<size_t, size_t> blockBytes(const size_t blockIdx,
+                                                   const size_t blockEntries) const {
+        if (mCompressed) {
+            assert(blockEntries == mBlockEntries);
+
+            return {mBlockOffsets[blockIdx],
+                    mBlockOffsets[blockIdx + 1] - mBlockOffsets[blockIdx]};
+        }
+
+        const size_t firstEntry = blockIdx * blockEntries;
+        assert(firstEntry < mNumEntries);
+
+        const size_t numEntries = std::min(blockEntries, mNumEntries - firstEntry);
+        return {entryOffsetBytes(firstEntry), numEntries * mEntrySizeBytes};
+    }
+
+    // Hint the kernel that we will soon read these entries, so it can start paging them in
+    constexpr void prefetch(const size_t firstEntry, const size_t count) const {
+        assert(count > 0 && firstEntry + count <= mNumEntries);
+
+#ifndef _WIN32
+        if (!isMapped()) {
+            return;
+        }
+
+        // madvise() needs a page-aligned address
+        const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+        const size_t startByte = mCompressed ? mBlockOffsets[firstEntry / mBlockEntries]
+                                             : entryOffsetBytes(firstEntry);
+
+        const size_t endByte = mCompressed
+                                   ? mBlockOffsets[(firstEntry + count - 1) / mBlockEntries + 1]
+                                   : entryOffsetBytes(firstEntry + count);
+
+        const size_t alignedStartByte = startByte - startByte % pageSize;
+
+        madvise(const_cast<char*>(mMapped + alignedStartByte),
+                endByte - alignedStartByte,
+                MADV_WILLNEED);
+#endif
+    }
+
+   private:
+    constexpr size_t entryOffsetBytes(const size_t entryIdx) const {
+        return mHeaderSizeBytes + entryIdx * mEntrySizeBytes;
+    }
+
+};  // class DataFile
+
+// A thread's own access to the entries of a DataFile
+// Holds the thread's stream (opened on first read through it), and if the file is compressed,
+// the last couple of blocks it decompressed, as a batch-sized block may straddle 2 of them
+class DataFileReader {
+   private:
+    struct DecompressedBlock {
+       public:
+        size_t blockIdx;
+        u64 lastUse;
+        std::vector<StarwayDataEntry> entries;
+    };
+
+    const DataFile* mDataFile = nullptr;
+    std::ifstream mStream;
+
+    // Only used if the data file is compressed
+    std::vector<u8> mCompressedBytes;
+    std::vector<DecompressedBlock> mBlocks;
+    size_t mMaxBlocks = 1;
+    u64 mUses = 0;
+
+    // Only used to check the CRC32C of blocks read partially, if the data file isn't mapped
+    std::vector<u8> mVerifyBuffer;
+
+   public:
+    DataFileReader() {}
+
+    DataFileReader(const DataFile& dataFile, const size_t maxDecompressedBlocks) {
+        assert(maxDecompressedBlocks > 0);
+
+        mDataFile = &dataFile;
+        mMaxBlocks = maxDecompressedBlocks;
+    }
+
+    // Returns a pointer to the bytes of `count` consecutive data entries starting at
+    // entry `firstEntry`
+    // If the file is mapped and not compressed, the pointer points into the mapped pages (no copy)
+    // Otherwise, the entries are read with readEntries() into `buffer`
+    constexpr const char* getEntries(const size_t firstEntry,
+                                     const size_t count,
+                                     char* buffer) {
+        assert(firstEntry + count <= mDataFile->mNumEntries);
+
+        if (mDataFile->isZeroCopy()) {
+            const char* entries = mDataFile->mMapped + mDataFile->entryOffsetBytes(firstEntry);
+            verifyEntries(firstEntry, count, entries);
+            return entries;
+        }
+
+        readEntries(firstEntry, count, buffer);
+        return buffer;
+    }
+
+    // Copies the bytes of `count` consecutive data entries starting at entry `firstEntry`
+    // into `buffer`, even if the file is mapped
+    // Uncompressed entries are read with a single read() from the stream
+    constexpr void readEntries(const size_t firstEntry, const size_t count, char* buffer) {
+        assert(firstEntry + count <= mDataFile->mNumEntries);
+
+        if (!mDataFile->isCompressed()) {
+            openStream();
+
+            mStream.seekg(static_cast<i64>(mDataFile->entryOffsetBytes(firstEntry)),
+                          std::ios::beg);
+
+            mStream.read(buffer, static_cast<i64>(count * mDataFile->mEntrySizeBytes));
+
+            assert(mStream);
+
+            verifyEntries(firstEntry, count, buffer);
+            return;
+        }
+
+        // Copy the entries from each block they're in
+        const size_t blockEntries = mDataFile->mBlockEntries;
+
+        for (size_t entryIdx = firstEntry; entryIdx < firstEntry + count;) {
+            const size_t blockIdx = entryIdx / blockEntries;
+            const size_t idxInBlock = entryIdx % blockEntries;
+            const size_t numToCopy =
+                std::min(blockEntries - idxInBlock, firstEntry + count - entryIdx);
+
+            const StarwayDataEntry* block = getBlock(blockIdx);
+
+            std::memcpy(buffer + (entryIdx - firstEntry) * sizeof(StarwayDataEntry),
+                        block + idxInBlock,
+                        numToCopy * sizeof(StarwayDataEntry));
+
+            entryIdx += numToCopy;
+        }
+    }
+
+   private:
+    // If the data file is trusted, checks the CRC32C of the blocks of these entries
+    // not yet checked
+    // The blocks' bytes not in `entries` are read from the file
+    constexpr void verifyEntries(const size_t firstEntry, const size_t count, const char* entries) {
+        if (!mDataFile->isTrusted()) {
+            return;
+        }
+
+        const size_t blockEntries = mDataFile->mStampBlockEntries;
+        const size_t endEntry = firstEntry + count;
+
+        for (size_t blockIdx = firstEntry / blockEntries; blockIdx * blockEntries < endEntry;
+             blockIdx++) {
+            if (mDataFile->mBlockVerified[blockIdx].load(std::memory_order_relaxed)) {
+                continue;
+            }
+
+            const size_t blockFirstEntry = blockIdx * blockEntries;
+            const size_t blockEndEntry =
+                std::min(blockFirstEntry + blockEntries, mDataFile->mNumEntries);
+
+            if (blockFirstEntry >= firstEntry && blockEndEntry <= endEntry) {
+                const char* blockBytes =
+                    entries + (blockFirstEntry - firstEntry) * mDataFile->mEntrySizeBytes;
+
+                verifyBlock(blockIdx,
+                            reinterpret_cast<const u8*>(blockBytes),
+                            (blockEndEntry - blockFirstEntry) * mDataFile->mEntrySizeBytes);
+            } else {
+                verifyBlock(blockIdx, nullptr, 0);
+            }
+        }
+    }
+
+    // Asserts the CRC32C of block blockIdx of the stamp matches
+    // If blockBytes is null, the block's bytes are read from the file
+    constexpr void verifyBlock(const size_t blockIdx, const u8* blockBytes, size_t numBytes) {
+        if (blockBytes == nullptr) {
+            const auto [offset, size] =
+                mDataFile->blockBytes(blockIdx, mDataFile->mStampBlockEntries);
+
+            numBytes = size;
+
+            if (mDataFile->isMapped()) {
+                blockBytes = reinterpret_cast<const u8*>(mDataFile->mMapped + offset);
+            } else {
+                mVerifyBuffer.resize(numBytes);
+
+                openStream();
+                mStream.seekg(static_cast<i64>(offset), std::ios::beg);
+                mStream.read(reinterpret_cast<char*>(mVerifyBuffer.data()),
+                             static_cast<i64>(numBytes));
+                assert(mStream);
+
+                blockBytes = mVerifyBuffer.data();
+            }
+        }
+
+        assert(crc32c(0, blockBytes, numBytes) == mDataFile->mBlockCrcs[blockIdx] &&
+               "Data file doesn't match its stamp (corrupted or modified after converting)");
+
+        mDataFile->mBlockVerified[blockIdx].store(true, std::memory_order_relaxed);
+    }
+
+    constexpr void openStream() {
+        if (!mStream.is_open()) {
+            mStream = std::ifstream(mDataFile->path(), std::ios::binary);
+        }
+
+        assert(mStream);
+    }
+
+    // Decompresses a block, unless it's one of the last ones decompressed
+    constexpr const StarwayDataEntry* getBlock(const size_t blockIdx) {
+        mUses++;
+
+        for (DecompressedBlock& block : mBlocks) {
+            if (block.blockIdx == blockIdx) {
+                block.lastUse = mUses;
+                return block.entries.data();
+            }
+        }
+
+        // Decompress into a new block if there's room, else into the least recently used one
+        DecompressedBlock* blockPtr;
+
+        if (mBlocks.size() < mMaxBlocks) {
+            blockPtr = &mBlocks.emplace_back();
+        } else {
+            blockPtr = &*std::min_element(
+                mBlocks.begin(), mBlocks.end(), [](const auto& a, const auto& b) {
+                    return a.lastUse < b.lastUse;
+                });
+        }
+
+        DecompressedBlock& block = *blockPtr;
+        block.blockIdx = blockIdx;
+        block.lastUse = mUses;
+
+        const size_t firstEntry = blockIdx * mDataFile->mBlockEntries;
+
+        const size_t numEntries =
+            std::min(mDataFile->mBlockEntries, mDataFile->mNumEntries - firstEntry);
+
+        block.entries.resize(numEntries);
+
+        const size_t offset = mDataFile->mBlockOffsets[blockIdx];
+        const size_t numBytes = mDataFile->mBlockOffsets[blockIdx + 1] - offset;
+        const u8* compressed;
+
+        if (mDataFile->isMapped()) {
+            compressed = reinterpret_cast<const u8*>(mDataFile->mMapped + offset);
+        } else {
+            mCompressedBytes.resize(numBytes);
+
+            openStream();
+            mStream.seekg(static_cast<i64>(offset), std::ios::beg);
+            mStream.read(reinterpret_cast<char*>(mCompressedBytes.data()),
+                         static_cast<i64>(numBytes));
+            assert(mStream);
+
+            compressed = mCompressedBytes.data();
+        }
+
+        if (mDataFile->isTrusted() &&
+            !mDataFile->mBlockVerified[blockIdx].load(std::memory_order_relaxed)) {
+            verifyBlock(blockIdx, compressed, numBytes);
+        }
+
+        decompressBlock(compressed, numBytes, numEntries, block.entries.data());
+
+        return block.entries.data();
+    }
+
+};  // class DataFileReader
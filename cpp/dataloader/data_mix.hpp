@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "../utils.hpp"
+#include "data_file.hpp"
+#include "shuffle.hpp"
+#include "window_cache.hpp"
+
+// A data file listed in a manifest, and the share of every batch that comes from it
+struct ManifestEntry {
+   public:
+    std::string path;
+    double weight;
+};
+
+// A manifest lists the data files to mix, 1 per line as "<weight> <path>"
+// Relative paths are relative to the manifest's folder
+// Empty lines and lines starting with '#' are ignored
+constexpr bool isManifest(const std::string& path) {
+    return std::filesystem::path(path).extension() == ".manifest";
+}
+
+inline std::vector<ManifestEntry> readManifest(const std::string& manifestPath) {
+    std::ifstream manifest(manifestPath);
+    assert(manifest);
+
+    const std::filesystem::path folder = std::filesystem::path(manifestPath).parent_path();
+
+    std::vector<ManifestEntry> entries;
+    std::string line;
+
+    while (std::getline(manifest, line)) {
+        trim(line);
+
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        const size_t weightEnd = line.find_first_of(" \t");
+        assert(weightEnd != std::string::npos && "Manifest line must be '<weight> <path>'");
+
+        std::string path = line.substr(weightEnd + 1);
+        trim(path);
+
+        const double weight = std::stod(line.substr(0, weightEnd));
+
+        entries.push_back(ManifestEntry{(folder / path).string(), weight});
+    }
+
+    assert(!entries.empty());
+
+    return entries;
+}
+
+// A data file and the order its entries are visited in
+struct DataSource {
+   public:
+    std::unique_ptr<DataFile> dataFile;
+    Shuffler shuffler;
+
+    // Null unless workers share the shuffle windows they read (see WindowCache)
+    std::unique_ptr<WindowCache<char>> windowCache = nullptr;
+
+    // Null unless filtering entries and workers share the batch numbers they decode
+    // Positions in each filter window of the entries the entry filter keeps
+    // (see Worker::loadFilteredEntries())
+    std::unique_ptr<WindowCache<u32>> filterCache = nullptr;
+
+    // Entries of this data file decoded into the batches next_batch() served since init()
+    std::unique_ptr<std::atomic<u64>> entriesServed = std::make_unique<std::atomic<u64>>(0);
+};
+
+// How many entries of every batch come from each data source
+// Every batch has the same composition, the weights rounded to whole entries (largest remainder),
+// so batch n takes entries [n * count, (n + 1) * count) of each source's shuffler order
+class DataMix {
+   private:
+    std::vector<size_t> mCountInBatch;
+    std::vector<size_t> mFirstIdxInBatch;
+
+   public:
+    constexpr DataMix() {}
+
+    constexpr DataMix(const std::vector<double>& weights, const size_t batchSize) {
+        assert(!weights.empty());
+
+        const double weightsSum = std::accumulate(weights.begin(), weights.end(), 0.0);
+        std::vector<double> remainders;
+        size_t assigned = 0;
+
+        for (const double weight : weights) {
+            assert(weight > 0.0);
+
+            const double exactCount = weight / weightsSum * static_cast<double>(batchSize);
+            const size_t count = static_cast<size_t>(std::floor(exactCount));
+
+            mCountInBatch.push_back(count);
+            remainders.push_back(exactCount - static_cast<double>(count));
+            assigned += count;
+        }
+
+        assert(assigned <= batchSize);
+
+        // Hand the entries left to the sources with the largest remainders
+        for (; assigned < batchSize; assigned++) {
+            const auto it = std::max_element(remainders.begin(), remainders.end());
+            const size_t source = static_cast<size_t>(it - remainders.begin());
+
+            mCountInBatch[source]++;
+            *it = -1.0;
+        }
+
+        for (size_t source = 0; source < mCountInBatch.size(); source++) {
+            assert(mCountInBatch[source] > 0 && "Data source weight too small for the batch size");
+
+            mFirstIdxInBatch.push_back(source == 0 ? 0
+                                                   : mFirstIdxInBatch[source - 1] +
+                                                         mCountInBatch[source - 1]);
+        }
+    }
+
+    constexpr size_t numSources() const { return mCountInBatch.size(); }
+
+    constexpr size_t countInBatch(const size_t source) const { return mCountInBatch[source]; }
+
+    // Entries [firstIdxInBatch, firstIdxInBatch + countInBatch) of a batch come from this source
+    constexpr size_t firstIdxInBatch(const size_t source) const {
+        return mFirstIdxInBatch[source];
+    }
+
+};  // class DataMix
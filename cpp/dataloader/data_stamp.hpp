@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <string>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#include "../utils.hpp"
+
+// A data file's stamp is a sidecar file (see stampPath()) written by the converter, which fully
+// validated every data entry, with a CRC32C of every block of the data file
+// Block i holds entries [i * mBlockEntries, (i + 1) * mBlockEntries)
+// (for a compressed data file, block i is its compressed block i)
+// The dataloader can then trust the data file: check each block's CRC32C the 1st time it's read,
+// instead of validating every data entry every time it's decoded
+// Stamp file = DataStampHeader, then the u32 CRC32C of each block
+constexpr u32 DATA_STAMP_MAGIC = 0x54535453;  // "STST" when read as chars
+
+constexpr u32 DATA_STAMP_VERSION = 1;
+
+// Debug builds (compiled with -DDEBUG) validate every data entry even if its data file is trusted
+#ifdef DEBUG
+constexpr bool DEBUG_BUILD = true;
+#else
+constexpr bool DEBUG_BUILD = false;
+#endif
+
+struct DataStampHeader {
+   public:
+    u32 mMagic;
+    u32 mVersion;
+
+    // Of the data file, so a stamp of an older version of the file is never used
+    u64 mFileSizeBytes;
+
+    u64 mBlockEntries;
+    u64 mNumBlocks;
+
+};  // struct DataStampHeader
+
+static_assert(sizeof(DataStampHeader) == 32);  // 32 bytes
+
+constexpr std::string stampPath(const std::string& dataFilePath) {
+    return dataFilePath + ".stamp";
+}
+
+// Castagnoli polynomial, bit-reflected
+constexpr u32 CRC32C_POLYNOMIAL = 0x82F63B78;
+
+// For CPUs without SSE 4.2 (or builds without -march=native), 1 byte at a time
+constexpr std::array<u32, 256> CRC32C_TABLE = [] {
+    std::array<u32, 256> table = {};
+
+    for (u32 i = 0; i < 256; i++) {
+        u32 crc = i;
+
+        for (size_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+        }
+
+        table[i] = crc;
+    }
+
+    return table;
+}();
+
+// CRC32C of numBytes bytes, continuing from the CRC32C of the bytes before them (0 if none)
+// Hardware CRC instruction 8 bytes at a time if compiled with SSE 4.2, else lookup table
+constexpr u32 crc32c(u32 crc, const void* data, size_t numBytes) {
+    const auto* bytes = static_cast<const u8*>(data);
+    crc = ~crc;
+
+#ifdef __SSE4_2__
+    for (; numBytes >= sizeof(u64); numBytes -= sizeof(u64), bytes += sizeof(u64)) {
+        u64 word;
+        std::memcpy(&word, bytes, sizeof(u64));
+        crc = static_cast<u32>(_mm_crc32_u64(crc, word));
+    }
+#endif
+
+    for (; numBytes > 0; numBytes--, bytes++) {
+        crc = CRC32C_TABLE[(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
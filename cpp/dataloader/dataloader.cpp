@@ -1,75 +1,427 @@
-#include <future>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <print>
+#include <string>
 #include <vector>
 
 #include "../converter/data_entry.hpp"
+#include "../trace.hpp"
 #include "../utils.hpp"
+#include "affinity.hpp"
 #include "batch.hpp"
+#include "batch_cache.hpp"
+#include "batch_queue.hpp"
+#include "data_file.hpp"
+#include "data_mix.hpp"
+#include "dataloader.hpp"
+#include "feature_sets.hpp"
+#include "options.hpp"
+#include "served_batches.hpp"
+#include "shard.hpp"
+#include "shuffle.hpp"
+#include "stats.hpp"
+#include "window_cache.hpp"
 #include "worker.hpp"
 
-// Needed to export functions on Windows
-#ifdef _WIN32
-#define API __declspec(dllexport)
-#else
-#define API
-#endif
+// Args of init(), kept to restart the workers in set_state()
+size_t gBatchSize = 0;
+size_t gNumThreads = 0;
+DataloaderOptions gOptions = {};
+std::string gCpuList = "";
+
+// Empty if not tracing
+std::string gTracePath = "";
+
+// Spans opened by trace_begin() and not yet closed by trace_end(), of the calling thread
+thread_local std::vector<TraceEvent> gOpenTraceSpans = {};
+
+std::vector<DataSource> gSources = {};
+DataMix gDataMix = DataMix();
+Shard gShard = Shard();
+std::atomic<u64> gBatchCursor = 0;
+
+// Null if not caching batches
+// Kept by set_state(), as a batch number's contents don't depend on when it's decoded
+std::unique_ptr<BatchCache> gBatchCache = nullptr;
+
+// See DataloaderStateHeader
+u64 gConfigHash = 0;
+
+// Batch numbers next_batch() served, including those served before resuming
+ServedBatches gServedBatches = ServedBatches();
+
+// Only set by set_state()
+ServedBatches gServedBeforeResume = ServedBatches();
+
+// Time next_batch() spent waiting for workers to decode a batch
+u64 gConsumerStallNs = 0;
+std::unique_ptr<BatchQueue> gReadyBatches = nullptr;
+std::vector<std::unique_ptr<Worker>> gWorkers = {};
+
+// Creates the batch queue and workers, and makes the workers start working
+void startWorkers() {
+    // Every batch workers own can be in the queue at the same time
+    gReadyBatches = std::make_unique<BatchQueue>(
+        gNumThreads * gOptions.prefetchBatches, gOptions.deterministic, gServedBeforeResume);
+
+    const std::vector<WorkerPlacement> placements =
+        gOptions.pinThreads ? placeWorkers(gNumThreads, gOptions.threadsPerBatch, gCpuList)
+                            : std::vector<WorkerPlacement>(gNumThreads);
+
+    // Allocate workers
+    // The buffers a worker fills while being constructed go on its NUMA node too
+    for (size_t i = 0; i < gNumThreads; i++) {
+        if (placements[i].numaNode >= 0) {
+            preferNumaNode(placements[i].numaNode);
+        }
 
-std::vector<Worker> gWorkers = {};
-i32 gWorkerIdx = -1;
+        gWorkers.push_back(std::make_unique<Worker>(i,
+                                                    gNumThreads,
+                                                    gSources,
+                                                    gDataMix,
+                                                    gShard,
+                                                    gBatchCursor,
+                                                    *gReadyBatches,
+                                                    gServedBeforeResume,
+                                                    gBatchCache.get(),
+                                                    gBatchSize,
+                                                    gOptions,
+                                                    placements[i]));
+
+        if (placements[i].numaNode >= 0) {
+            preferNumaNode(-1);
+        }
+    }
+
+    // Make workers start working
+    for (std::unique_ptr<Worker>& worker : gWorkers) {
+        worker->start();
+    }
+}
 
 extern "C" API void init(const char* dataFilePath,
                          const size_t batchSize,
-                         const size_t numThreads) {
+                         const size_t numThreads,
+                         const DataloaderOptions* options) {
     assert(batchSize > 0);
     assert(numThreads > 0);
+    assert(options != nullptr);
+    assert(options->threadsPerBatch > 0);
+    assert(options->worldSize > 0 && options->rank < options->worldSize);
+    assert(gWorkers.empty() && "Call shutdown() before calling init() again");
 
-    // Open data file
-    std::ifstream dataFile(dataFilePath, std::ios::binary | std::ios::ate);
-    assert(dataFile);
+    gBatchSize = batchSize;
+    gNumThreads = numThreads;
+    gOptions = *options;
 
-    // Assert file has at least 1 batch for each thread
-    const i64 fileSizeBytes = dataFile.tellg();
-    assert(fileSizeBytes >= static_cast<i64>(numThreads * batchSize * sizeof(StarwayDataEntry)));
+    // The string options points to may not outlive this call
+    gCpuList = options->cpuList != nullptr ? options->cpuList : "";
+    gOptions.cpuList = nullptr;
 
-    // Assert file doesn't end in the middle of a data entry
-    assert(static_cast<size_t>(fileSizeBytes) % sizeof(StarwayDataEntry) == 0);
+    gTracePath = options->tracePath != nullptr ? options->tracePath : "";
+    gOptions.tracePath = nullptr;
 
-    // Assert file ends with a full batch of data entries
-    assert((static_cast<size_t>(fileSizeBytes) / sizeof(StarwayDataEntry)) % batchSize == 0);
+    // Unlike that string, feature sets' names live as long as the program
+    gOptions.featureSet = featureSetName(options->featureSet);
 
-    // Allocate workers
-    for (size_t i = 0; i < numThreads; i++) {
-        gWorkers.push_back(Worker(i, dataFilePath, static_cast<size_t>(fileSizeBytes), batchSize));
+    if (!gTracePath.empty()) {
+        gTracer.start();
+        setTraceThreadName("consumer");
     }
 
-    // Make workers start working
-    for (Worker& worker : gWorkers) {
-        worker.mFuture = std::async(
-            std::launch::async, &Worker::getNextBatch, &worker, gWorkers.size(), batchSize);
+    if (options->consumerNumaNode >= 0) {
+        const std::vector<size_t> nodeCpus = numaNodeCpus(options->consumerNumaNode);
+
+        if (pinThisThread(nodeCpus)) {
+            std::println("Dataloader: pinned consumer thread to NUMA node {}",
+                         options->consumerNumaNode);
+        } else {
+            std::println("Dataloader: couldn't pin consumer thread to NUMA node {}",
+                         options->consumerNumaNode);
+        }
+    }
+
+    // A single data file, or a manifest of data files to mix
+    const std::vector<ManifestEntry> manifest =
+        isManifest(dataFilePath) ? readManifest(dataFilePath)
+                                 : std::vector<ManifestEntry>{ManifestEntry{dataFilePath, 1.0}};
+
+    std::vector<double> weights;
+
+    for (const ManifestEntry& manifestEntry : manifest) {
+        weights.push_back(manifestEntry.weight);
+    }
+
+    gDataMix = DataMix(weights, batchSize);
+
+    // Contiguous ranges depend on the number of workers, shuffle windows don't
+    gConfigHash = hashCombine(batchSize, options->contiguousChunkBytes);
+    gConfigHash = hashCombine(gConfigHash, options->contiguousChunkBytes > 0 ? numThreads : 0);
+    gConfigHash = hashCombine(gConfigHash, options->shuffle ? options->shuffleSeed : 0);
+    gConfigHash = hashCombine(gConfigHash, options->shuffle ? options->shuffleWindowBatches : 0);
+    gConfigHash = hashCombine(gConfigHash, options->batchCacheBytes > 0);
+
+    // Ranks serve different batches
+    if (options->worldSize > 1) {
+        gConfigHash = hashCombine(gConfigHash, hashCombine(options->rank, options->worldSize));
+    }
+
+    // Batches are made of the entries kept among those of their filter window
+    if (options->filterEntries) {
+        for (const u64 filterSetting : {options->shuffleWindowBatches,
+                                        static_cast<u64>(options->filterMaxAbsScore),
+                                        static_cast<u64>(options->filterResults),
+                                        static_cast<u64>(options->filterMinPieces),
+                                        static_cast<u64>(options->filterMaxPieces),
+                                        static_cast<u64>(options->filterInCheck),
+                                        static_cast<u64>(options->filterMinLegalMoves),
+                                        static_cast<u64>(options->filterMaxLegalMoves)}) {
+            gConfigHash = hashCombine(gConfigHash, filterSetting);
+        }
+    }
+
+    // Open data files once, shared by all workers
+    for (size_t i = 0; i < manifest.size(); i++) {
+        auto dataFile = std::make_unique<DataFile>(manifest[i].path, options->useMmap);
+
+        if (manifest.size() == 1) {
+            // Assert file has at least 1 batch for each thread of each rank
+            assert(dataFile->numEntries() >= numThreads * options->worldSize * batchSize);
+
+            // Assert file ends with a full batch of data entries
+            assert(dataFile->numEntries() % batchSize == 0);
+        } else {
+            // Entries after the file's last full batch are never served
+            assert(dataFile->numEntries() >= batchSize);
+        }
+
+        assert((!dataFile->isFeaturized() ||
+                std::string(gOptions.featureSet) == DefaultFeatureSet::NAME) &&
+               "Pre-featurized data files only have the default feature set's features");
+
+        if (options->trustStampedData && !dataFile->trust()) {
+            std::println("Dataloader: no valid stamp for {}, validating every entry",
+                         manifest[i].path);
+        }
+
+        if (options->useMmap && !dataFile->isMapped()) {
+            std::println("Dataloader: mmap unavailable for {}, falling back to stream reads",
+                         manifest[i].path);
+        }
+
+        // The 1st data source shuffles like it would on its own
+        const u64 seed = i == 0 ? options->shuffleSeed : hashCombine(options->shuffleSeed, i);
+
+        const Shuffler shuffler(options->shuffle,
+                                seed,
+                                dataFile->numEntries() / batchSize * batchSize,
+                                batchSize,
+                                options->shuffleWindowBatches);
+
+        gConfigHash = hashCombine(gConfigHash, dataFile->numEntries());
+        gConfigHash = hashCombine(gConfigHash, gDataMix.countInBatch(i));
+
+        DataSource source{std::move(dataFile), shuffler};
+
+        // Unless entries are read in place, every batch of a shuffle window would read
+        // (and decompress) the whole window, so workers read each window once and share it
+        // A mixed batch takes entries of at most 2 windows of each data source,
+        // and a filtered one of the windows its filter window spans
+        const bool sharesWindows =
+            manifest.size() > 1 || options->filterEntries || shuffler.windowBlocks() > 1;
+
+        if (sharesWindows && options->contiguousChunkBytes == 0 &&
+            !source.dataFile->isZeroCopy()) {
+            size_t maxWindowsInUse = manifest.size() > 1 ? 2 : 1;
+
+            if (options->filterEntries) {
+                maxWindowsInUse = options->shuffleWindowBatches + 1;
+            }
+
+            source.windowCache = std::make_unique<WindowCache<char>>(numThreads, maxWindowsInUse);
+        }
+
+        if (options->filterEntries && options->contiguousChunkBytes == 0) {
+            source.filterCache = std::make_unique<WindowCache<u32>>(numThreads, 1);
+        }
+
+        gSources.push_back(std::move(source));
+    }
+
+    // Mixed batches have no epochs, so ranks take turns (rank r serves every worldSize-th batch)
+    const size_t epochBatches =
+        gSources.size() > 1 ? options->worldSize : gSources[0].shuffler.numBlocks();
+
+    gShard = Shard(options->rank, options->worldSize, epochBatches);
+
+    if (options->worldSize > 1) {
+        std::println("Dataloader: rank {} of {}", options->rank, options->worldSize);
+    }
+
+    if (std::string(gOptions.featureSet) != DefaultFeatureSet::NAME) {
+        std::println("Dataloader: feature set {}", gOptions.featureSet);
     }
+
+    if (options->batchCacheBytes > 0) {
+        gBatchCache = std::make_unique<BatchCache>(
+            gSources[0].shuffler.numBlocks(), batchSize, options->batchCacheBytes);
+    }
+
+    startWorkers();
 }
 
-extern "C" API Batch* next_batch(const size_t batchSize) {
+// Stops and joins the worker threads and closes the data files
+// After this, init() can be called again
+extern "C" API void shutdown() {
+    // Destroying a worker stops and joins its thread
+    gWorkers.clear();
+
+    if (!gTracePath.empty()) {
+        gTracer.stop(gTracePath);
+        gTracePath = "";
+    }
+
+    gReadyBatches = nullptr;
+    gBatchCache = nullptr;
+    gCpuList = "";
+    gSources.clear();
+    gDataMix = DataMix();
+    gShard = Shard();
+    gBatchCursor = 0;
+    gConfigHash = 0;
+    gServedBatches = ServedBatches();
+    gServedBeforeResume = ServedBatches();
+    gConsumerStallNs = 0;
+}
+
+// Writes the dataloader state (see DataloaderStateHeader) to state, if not null and capacity
+// is enough, and returns its size in bytes
+// Restoring it with set_state() resumes the exact same stream of batches
+extern "C" API size_t get_state(u8* state, const size_t capacity) {
     assert(gWorkers.size() > 0);
 
-    // After the first next_batch() call, make the last used worker load his next batch async
-    // since the last batch is no longer being used by PyTorch
-    if (gWorkerIdx != -1) {
-        Worker& worker = gWorkers[static_cast<size_t>(gWorkerIdx)];
+    const size_t stateSizeBytes = gServedBatches.serializedSizeBytes();
 
-        worker.mFuture = std::async(
-            std::launch::async, &Worker::getNextBatch, &worker, gWorkers.size(), batchSize);
+    if (state != nullptr && capacity >= stateSizeBytes) {
+        gServedBatches.serialize(gConfigHash, state);
     }
 
-    gWorkerIdx = (gWorkerIdx + 1) % static_cast<i32>(gWorkers.size());
+    return stateSizeBytes;
+}
+
+// Restores a state from get_state(), so next_batch() continues where that dataloader was
+// Must be called after init() and before next_batch(), with the same data file,
+// batch size and shuffle settings (with CONTIGUOUS_CHUNK_MB, also the same number of threads)
+extern "C" API void set_state(const u8* state, const size_t stateSizeBytes) {
+    assert(gWorkers.size() > 0);
+    assert(gServedBatches.count() == 0 && "Call set_state() before next_batch()");
+
+    gServedBeforeResume = ServedBatches::deserialize(gConfigHash, state, stateSizeBytes);
+    gServedBatches = gServedBeforeResume;
 
-    Worker& worker = gWorkers[static_cast<size_t>(gWorkerIdx)];
+    // Throw away the batches decoded so far and restart from the restored state
+    gWorkers.clear();
+    gReadyBatches = nullptr;
+    gBatchCursor = gServedBeforeResume.watermark();
 
-    return worker.mFuture.get();
+    startWorkers();
+}
+
+// Number of data files batches are made from (more than 1 if init() was given a manifest)
+extern "C" API size_t num_sources() { return gSources.size(); }
+
+// Fills positionsServed[i] with how many positions of the i-th data file were decoded into
+// the batches next_batch() served since init() (not counting those served before resuming)
+extern "C" API void get_positions_served(u64* positionsServed) {
+    for (size_t i = 0; i < gSources.size(); i++) {
+        positionsServed[i] = gSources[i].entriesServed->load(std::memory_order_relaxed);
+    }
 }
 
+// Returns whichever batch got decoded first, or the next one in order if deterministic
+// The returned batch must be given back with release_batch() once PyTorch no longer needs it
+// Batches the entry filter kept too few entries to fill are skipped, and count as served
+extern "C" API Batch* next_batch([[maybe_unused]] const size_t batchSize) {
+    assert(gWorkers.size() > 0);
+
+    const TraceSpan span("wait for batch");
+
+    const auto popStart = std::chrono::steady_clock::now();
+    const ReadyBatch readyBatch = gReadyBatches->pop();
+    gConsumerStallNs += nanosecondsSince(popStart);
+
+    gServedBatches.add(readyBatch.batchNum);
+
+    for (size_t i = 0; i < readyBatch.numSkipped; i++) {
+        gServedBatches.add(readyBatch.skippedBatchNums[i]);
+    }
+
+    for (size_t i = 0; i < gSources.size(); i++) {
+        gSources[i].entriesServed->fetch_add(readyBatch.entriesPerSource[i],
+                                             std::memory_order_relaxed);
+    }
+
+    return readyBatch.batch;
+}
+
+// Lets the worker that decoded this batch decode into its memory again
+extern "C" API void release_batch(const Batch* batch) {
+    for (std::unique_ptr<Worker>& worker : gWorkers) {
+        if (worker->isNextToRelease(batch)) {
+            worker->releaseBatch(batch);
+            return;
+        }
+    }
+
+    assert(false && "Released batch wasn't served by next_batch() or was already released");
+}
+
+// Fills workerStats[i] with the cumulative stats of the i-th worker (numThreads given to init())
+// and returns the time next_batch() spent waiting for workers, in nanoseconds
+// If the consumer waits a lot, training is bound by the dataloader, else by the GPU
+extern "C" API u64 get_stats(WorkerStats* workerStats) {
+    for (size_t i = 0; i < gWorkers.size(); i++) {
+        workerStats[i] = gWorkers[i]->getStats();
+    }
+
+    return gConsumerStallNs;
+}
+
+// Zero all stats returned by get_stats()
+extern "C" API void reset_stats() {
+    for (std::unique_ptr<Worker>& worker : gWorkers) {
+        worker->resetStats();
+    }
+
+    gConsumerStallNs = 0;
+}
+
+// Opens a span of the calling thread in the trace, if tracing (see DataloaderOptions.tracePath),
+// such as a training step to line up with the dataloader's spans
+extern "C" API void trace_begin(const char* name) {
+    if (gTracer.isEnabled()) {
+        gOpenTraceSpans.push_back(
+            TraceEvent{gTracer.internName(name), gTracer.nowNs(), 0, nullptr, 0.0});
+    }
+}
+
+// Closes the calling thread's last span opened by trace_begin()
+extern "C" API void trace_end() {
+    if (gTracer.isEnabled() && !gOpenTraceSpans.empty()) {
+        TraceEvent event = gOpenTraceSpans.back();
+        gOpenTraceSpans.pop_back();
+
+        event.endNs = gTracer.nowNs();
+        recordTraceEvent(event);
+    }
+}
+
+// Programs linked with this file to call the dataloader directly (bench.cpp) have their own
+#ifndef DATALOADER_NO_MAIN
 int main() {
     std::println("Dataloader main()");
     return 0;
 }
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../utils.hpp"
+#include "batch.hpp"
+#include "options.hpp"
+#include "stats.hpp"
+
+// The dataloader's C API, defined and documented in dataloader.cpp
+// python/dataloader.py calls it in the shared library, and C++ programs (bench.cpp) include this
+// and are linked with dataloader.cpp
+
+// Needed to export functions on Windows
+#ifdef _WIN32
+#define API __declspec(dllexport)
+#else
+#define API
+#endif
+
+extern "C" {
+
+API void init(const char* dataFilePath,
+              const size_t batchSize,
+              const size_t numThreads,
+              const DataloaderOptions* options);
+
+API void shutdown();
+
+API size_t get_state(u8* state, const size_t capacity);
+
+API void set_state(const u8* state, const size_t stateSizeBytes);
+
+API size_t num_sources();
+
+API void get_positions_served(u64* positionsServed);
+
+API Batch* next_batch(const size_t batchSize);
+
+API void release_batch(const Batch* batch);
+
+API u64 get_stats(WorkerStats* workerStats);
+
+API void reset_stats();
+
+API void trace_begin(const char* name);
+
+API void trace_end();
+
+}  // extern "C"
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdlib>
+#include <optional>
+
+#include "../converter/data_entry.hpp"
+#include "../utils.hpp"
+#include "batch.hpp"
+#include "feature_sets.hpp"
+#include "featurized_entry.hpp"
+#include "options.hpp"
+
+// Drops data entries when loading them (see DataloaderOptions.filterEntries),
+// so trying other filters than the converter's (see DataFilter) needs no reconversion
+// Entries of Starway data files are checked without decoding them (mayAccept()),
+// with the legal moves count the converter stores in mMiscData, else by generating their
+// legal moves (countLegalMoves()) if the legal moves range can drop any (isExact())
+// Pre-featurized entries are checked with accepts()
+class EntryFilter {
+   private:
+    bool mEnabled = false;
+
+    i32 mMaxAbsScore = 0;
+    u8 mResults = 0;
+    size_t mMinPieces = 0;
+    size_t mMaxPieces = 0;
+    bool mDropInCheck = false;
+    size_t mMinLegalMoves = 0;
+    size_t mMaxLegalMoves = 0;
+
+   public:
+    constexpr EntryFilter() {}
+
+    constexpr EntryFilter(const DataloaderOptions& options) {
+        mEnabled = options.filterEntries;
+
+        if (!mEnabled) {
+            return;
+        }
+
+        assert(options.filterResults > 0 && options.filterResults <= 0b111);
+        assert(options.filterMinPieces <= options.filterMaxPieces);
+        assert(options.filterMinLegalMoves <= options.filterMaxLegalMoves);
+
+        mMaxAbsScore = options.filterMaxAbsScore;
+        mResults = options.filterResults;
+        mMinPieces = options.filterMinPieces;
+        mMaxPieces = options.filterMaxPieces;
+        mDropInCheck = options.filterInCheck;
+        mMinLegalMoves = options.filterMinLegalMoves;
+        mMaxLegalMoves = options.filterMaxLegalMoves;
+    }
+
+    constexpr bool isEnabled() const { return mEnabled; }
+
+    // False if the entry is certainly dropped, without decoding it
+    // Its legal moves aren't checked if its data file doesn't store how many there are
+    constexpr bool mayAccept(const StarwayDataEntry& entry) const {
+        const size_t numLegalMoves = entry.get(Mask::NUM_LEGAL_MOVES);
+
+        return accepts(entry.mStmScore,
+                       entry.get(Mask::STM_RESULT),
+                       static_cast<size_t>(std::popcount(entry.mOccupied)),
+                       entry.get(Mask::IN_CHECK),
+                       numLegalMoves > 0 ? std::optional<size_t>(numLegalMoves) : std::nullopt);
+    }
+
+    // Whether mayAccept(entry) is exact, so the entry's legal moves needn't be counted
+    // Every data entry has a legal best move, so a minimum of 1 legal move checks nothing
+    constexpr bool isExact(const StarwayDataEntry& entry) const {
+        return entry.get(Mask::NUM_LEGAL_MOVES) > 0 ||
+               (mMinLegalMoves <= 1 && mMaxLegalMoves >= MAX_MOVES_PER_POS);
+    }
+
+    // The legal moves check mayAccept() skips if the data file doesn't store their count
+    constexpr bool acceptsLegalMoves(const size_t numLegalMoves) const {
+        return numLegalMoves >= mMinLegalMoves && numLegalMoves <= mMaxLegalMoves;
+    }
+
+    constexpr bool accepts(const FeaturizedEntry& featurized) const {
+        const auto numValid = [](const i16* array, const size_t size) -> size_t {
+            return static_cast<size_t>(std::find(array, array + size, -1) - array);
+        };
+
+        // Features of a position with the side to move in check are offset by 768 in their bucket
+        const bool inCheck =
+            featurized.mActiveFeaturesStm[0] % static_cast<i16>(FEATURES_PER_KING_BUCKET) >= 768;
+
+        return accepts(featurized.mStmScore,
+                       featurized.mStmResult,
+                       numValid(featurized.mActiveFeaturesStm, MAX_PIECES_PER_POS),
+                       inCheck,
+                       numValid(featurized.mLegalMovesIdxs, MAX_MOVES_PER_POS));
+    }
+
+   private:
+    constexpr bool accepts(const i16 stmScore,
+                           const u32 stmResult,
+                           const size_t numPieces,
+                           const bool inCheck,
+                           const std::optional<size_t> numLegalMoves) const {
+        if (!mEnabled) {
+            return true;
+        }
+
+        if (std::abs(static_cast<i32>(stmScore)) > mMaxAbsScore) {
+            return false;
+        }
+
+        if (((mResults >> stmResult) & 1) == 0) {
+            return false;
+        }
+
+        if (numPieces < mMinPieces || numPieces > mMaxPieces) {
+            return false;
+        }
+
+        if (inCheck && mDropInCheck) {
+            return false;
+        }
+
+        return !numLegalMoves.has_value() ||
+               (*numLegalMoves >= mMinLegalMoves && *numLegalMoves <= mMaxLegalMoves);
+    }
+
+};  // class EntryFilter
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+#include "../chess/types.hpp"
+#include "../utils.hpp"
+
+// Input feature sets the dataloader can compute, each a compile-time policy type
+// The feature of a piece, from the perspective of 1 side (stm or ntm), is
+//     kingBucket * FEATURES_PER_KING_BUCKET + inCheck * 768
+//     + pieceColor * 384 + pieceType * 64 + (square ^ xor)
+// xor flips ranks for the ntm perspective, and files if the side's king square mirrors
+// A feature set is its tables, indexed by the side's king square (oriented, before mirroring):
+//     MIRROR: flip files (so the king is on files E to H)
+//     KING_BUCKETS: king bucket, < NUM_KING_BUCKETS
+// Legal moves are mirrored like the stm features
+// Must match FEATURE_SET_INPUT_SIZES in python/settings.py
+
+// Every feature set has this layout, so in check can be told from any feature (see EntryFilter)
+constexpr size_t FEATURES_PER_KING_BUCKET = 768 * 2;
+
+constexpr std::array<bool, 64> MIRROR_KING_ON_FILES_A_TO_D = [] {
+    std::array<bool, 64> mirror;
+
+    for (size_t sq = 0; sq < 64; sq++) {
+        mirror[sq] = sq % 8 < static_cast<size_t>(File::E);
+    }
+
+    return mirror;
+}();
+
+// Default, and the only feature set of pre-featurized data files
+struct StarwayFeatures {
+   public:
+    static constexpr const char* NAME = "starway";
+
+    static constexpr size_t NUM_KING_BUCKETS = 1;
+    static constexpr std::array<bool, 64> MIRROR = MIRROR_KING_ON_FILES_A_TO_D;
+    static constexpr std::array<u8, 64> KING_BUCKETS = {};
+};
+
+struct NoMirrorFeatures {
+   public:
+    static constexpr const char* NAME = "no-mirror";
+
+    static constexpr size_t NUM_KING_BUCKETS = 1;
+    static constexpr std::array<bool, 64> MIRROR = {};
+    static constexpr std::array<u8, 64> KING_BUCKETS = {};
+};
+
+// Mirrored, with 4 buckets by the king's rank: 1st, 2nd, 3rd-4th, 5th-8th
+struct KingBuckets4Features {
+   public:
+    static constexpr const char* NAME = "king-buckets-4";
+
+    static constexpr size_t NUM_KING_BUCKETS = 4;
+    static constexpr std::array<bool, 64> MIRROR = MIRROR_KING_ON_FILES_A_TO_D;
+
+    static constexpr std::array<u8, 64> KING_BUCKETS = [] {
+        constexpr std::array<u8, 8> RANK_BUCKETS = {0, 1, 2, 2, 3, 3, 3, 3};
+        std::array<u8, 64> buckets;
+
+        for (size_t sq = 0; sq < 64; sq++) {
+            buckets[sq] = RANK_BUCKETS[sq / 8];
+        }
+
+        return buckets;
+    }();
+};
+
+// Every feature set the dataloader is built with, selectable by name at init()
+// (see DataloaderOptions.featureSet)
+using FeatureSets = std::tuple<StarwayFeatures, NoMirrorFeatures, KingBuckets4Features>;
+
+using DefaultFeatureSet = StarwayFeatures;
+
+// Features must fit in the i16 of a FeaturizedEntry
+static_assert(std::apply(
+    []<typename... FeatureSet>(FeatureSet...) {
+        return ((FeatureSet::NUM_KING_BUCKETS * FEATURES_PER_KING_BUCKET <= 32768) && ...);
+    },
+    FeatureSets()));
+
+// Calls visitor.template operator()<FeatureSet>() with the feature set named name
+// Returns false if no feature set has that name
+template <typename Visitor>
+constexpr bool visitFeatureSet(const std::string_view name, Visitor&& visitor) {
+    return std::apply(
+        [&]<typename... FeatureSet>(FeatureSet...) {
+            const auto visitIfNamed = [&]<typename Candidate>() {
+                if (std::string_view(Candidate::NAME) != name) {
+                    return false;
+                }
+
+                visitor.template operator()<Candidate>();
+                return true;
+            };
+
+            return (visitIfNamed.template operator()<FeatureSet>() || ...);
+        },
+        FeatureSets());
+}
+
+// The name (which lives as long as the program) of the feature set named name,
+// or of the default one if name is null or empty
+inline const char* featureSetName(const char* name) {
+    if (name == nullptr || std::string_view(name).empty()) {
+        return DefaultFeatureSet::NAME;
+    }
+
+    const char* result = nullptr;
+
+    visitFeatureSet(name, [&]<typename FeatureSet>() { result = FeatureSet::NAME; });
+
+    assert(result != nullptr && "Unknown feature set");
+    return result;
+}
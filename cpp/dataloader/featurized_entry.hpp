@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <optional>
+
+#include "../chess/move_gen.hpp"
+#include "../chess/position.hpp"
+#include "../chess/types.hpp"
+#include "../chess/util.hpp"
+#include "../converter/data_entry.hpp"
+#include "../utils.hpp"
+#include "batch.hpp"
+#include "feature_sets.hpp"
+#include "piece_unpack.hpp"
+#include "stats.hpp"
+
+// First 4 bytes of a pre-featurized data file ("STWY" when read as chars)
+// Read as a StarwayDataEntry.mMiscData, it has the bit that is never set (Mask::NEVER_SET),
+// so a Starway data file can never be mistaken for a pre-featurized one
+constexpr u32 FEATURIZED_MAGIC = 0x59575453;
+
+constexpr u32 FEATURIZED_VERSION = 1;
+
+// Pre-featurized data file = FeaturizedFileHeader followed by FeaturizedEntry's
+struct FeaturizedFileHeader {
+   public:
+    u32 mMagic;
+    u32 mVersion;
+    u32 mEntrySize;  // sizeof(FeaturizedEntry)
+    u32 mUnused;
+
+};  // struct FeaturizedFileHeader
+
+static_assert(sizeof(FeaturizedFileHeader) == 16);  // 16 bytes
+
+static_assert((FEATURIZED_MAGIC & static_cast<u32>(Mask::NEVER_SET)) != 0);
+
+// A data entry with everything the dataloader computes from it, so a batch can be filled
+// with just copies
+// No padding between fields, and 2-byte alignment holds for every entry of a data file
+struct FeaturizedEntry {
+   public:
+    // Padded with -1
+    i16 mActiveFeaturesStm[MAX_PIECES_PER_POS];
+    i16 mActiveFeaturesNtm[MAX_PIECES_PER_POS];
+
+    // [pieceTypeMoved][dstSquare][pieceTypeCaptured] of each legal move, padded with -1
+    i16 mLegalMovesIdxs[MAX_MOVES_PER_POS];
+
+    i16 mStmScore;
+
+    u8 mStmResult;  // 0 if stm lost, 1 if draw, 2 if stm won
+
+    u8 mBestMoveIdx;  // Index of best move in mLegalMovesIdxs
+
+    constexpr FeaturizedEntry() {}  // Does not init fields
+
+    constexpr void validate() const {
+        assert(mActiveFeaturesStm[0] != -1 && mActiveFeaturesNtm[0] != -1);
+        assert(mStmResult <= 2);
+        assert(mBestMoveIdx < MAX_MOVES_PER_POS);
+        assert(mLegalMovesIdxs[mBestMoveIdx] != -1);
+    }
+
+};  // struct FeaturizedEntry
+
+static_assert(sizeof(FeaturizedEntry) == 260);  // 260 bytes
+
+// Position of a data entry (side to move as white) from its unpacked pieces
+constexpr Position entryPosition(const StarwayDataEntry& entry, const UnpackedPieces& unpacked) {
+    Position pos;
+    pos.reset();
+
+    for (size_t i = 0; i < unpacked.mCount; i++) {
+        const u8 pieceColor = unpacked.mPieces[i] & 0b1;
+        const u8 pieceType = unpacked.mPieces[i] >> 1;
+        assert(pieceType <= static_cast<u8>(PieceType::King));
+
+        pos.togglePiece(static_cast<Color>(pieceColor),
+                        static_cast<PieceType>(pieceType),
+                        static_cast<Square>(unpacked.mSquares[i]));
+    }
+
+    if (entry.get(Mask::CASTLING_KS)) {
+        pos.enableCastlingRight(pos.mSideToMove, true);
+    }
+
+    if (entry.get(Mask::CASTLING_QS)) {
+        pos.enableCastlingRight(pos.mSideToMove, false);
+    }
+
+    if (entry.get(Mask::EP_FILE) < 8) {
+        const File epFile = static_cast<File>(entry.get(Mask::EP_FILE));
+        pos.setEpSquare(toSquare(epFile, Rank::Rank6));
+    }
+
+    return pos;
+}
+
+// Number of legal moves of a data entry, for data files that don't store it
+// (Mask::NUM_LEGAL_MOVES), generated without computing features or policy indices
+// If movegenNs isn't null, adds the time it takes to it
+constexpr size_t countLegalMoves(const StarwayDataEntry& entry, u64* movegenNs = nullptr) {
+    std::chrono::steady_clock::time_point movegenStart;
+
+    if (movegenNs != nullptr) {
+        movegenStart = std::chrono::steady_clock::now();
+    }
+
+    const Position pos = entryPosition(entry, unpackPieces(entry.mOccupied, entry.mPieces));
+    size_t numMoves = 0;
+
+    forEachLegalMove(pos, [&numMoves](const PieceType, const MontyformatMove) { numMoves++; });
+
+    if (movegenNs != nullptr) {
+        *movegenNs += nanosecondsSince(movegenStart);
+    }
+
+    return numMoves;
+}
+
+// Compute the input features (of FeatureSet, see feature_sets.hpp), legal moves' policy indices
+// and best move index of a data entry
+// If movegenNs isn't null, adds the time spent on the legal moves and policy indices to it
+// If !validate (entry of a trusted data file), skips the checks that the entry is valid,
+// except that its best move is legal
+template <typename FeatureSet = DefaultFeatureSet>
+constexpr FeaturizedEntry featurize(const StarwayDataEntry& entry,
+                                    u64* movegenNs = nullptr,
+                                    const bool validate = true) {
+    if (validate) {
+        entry.validate();
+    }
+
+    FeaturizedEntry featurized;
+
+    std::fill(std::begin(featurized.mLegalMovesIdxs),
+              std::end(featurized.mLegalMovesIdxs),
+              static_cast<i16>(-1));
+
+    const bool inCheck = entry.get(Mask::IN_CHECK);
+
+    const Square ourKingSqOriented = static_cast<Square>(entry.get(Mask::OUR_KING_SQ_ORIENTED));
+
+    const Square theirKingSqOriented = static_cast<Square>(entry.get(Mask::THEIR_KING_SQ_ORIENTED));
+
+    const size_t ourKingIdx = static_cast<size_t>(ourKingSqOriented);
+    const size_t theirKingIdx = static_cast<size_t>(theirKingSqOriented);
+
+    // Flip ranks if black to move
+    // Flip files if the feature set mirrors that color's king square
+    const bool mirrorStm = FeatureSet::MIRROR[ourKingIdx];
+    const u8 stmXor = mirrorStm ? 7 : 0;
+    const u8 ntmXor = FeatureSet::MIRROR[theirKingIdx] ? 56 ^ 7 : 56;
+
+    const size_t inCheckOffset = static_cast<size_t>(inCheck) * 768;
+
+    const i16 stmOffset = static_cast<i16>(
+        FeatureSet::KING_BUCKETS[ourKingIdx] * FEATURES_PER_KING_BUCKET + inCheckOffset);
+
+    const i16 ntmOffset = static_cast<i16>(
+        FeatureSet::KING_BUCKETS[theirKingIdx] * FEATURES_PER_KING_BUCKET + inCheckOffset);
+
+    const UnpackedPieces unpacked = unpackPieces(entry.mOccupied, entry.mPieces);
+
+    writeFeatures(unpacked,
+                  stmOffset,
+                  ntmOffset,
+                  stmXor,
+                  ntmXor,
+                  featurized.mActiveFeaturesStm,
+                  featurized.mActiveFeaturesNtm);
+
+    std::chrono::steady_clock::time_point movegenStart;
+
+    if (movegenNs != nullptr) {
+        movegenStart = std::chrono::steady_clock::now();
+    }
+
+    const Position pos = entryPosition(entry, unpacked);
+
+    featurized.mStmScore = entry.mStmScore;
+    featurized.mStmResult = static_cast<u8>(entry.get(Mask::STM_RESULT));
+
+    // Fill featurized.mLegalMovesIdxs and featurized.mBestMoveIdx
+
+    std::optional<size_t> bestMoveIdx;
+
+    const size_t numMoves = getPolicyIdxs(pos,
+                                          MontyformatMove(entry.mBestMove),
+                                          mirrorStm,
+                                          featurized.mLegalMovesIdxs,
+                                          bestMoveIdx);
+
+    // Checked even if !validate: it's cheap next to generating the moves,
+    // and a best move that isn't legal would give a garbage policy target
+    assert(bestMoveIdx.has_value() && "Best move of the data entry isn't legal");
+
+    if (validate) {
+        assert(numMoves > 0 && numMoves <= MAX_MOVES_PER_POS);
+
+        assert(entry.get(Mask::NUM_LEGAL_MOVES) == 0 ||
+               entry.get(Mask::NUM_LEGAL_MOVES) == numMoves);
+    }
+
+    featurized.mBestMoveIdx = static_cast<u8>(*bestMoveIdx);
+
+    if (movegenNs != nullptr) {
+        *movegenNs += nanosecondsSince(movegenStart);
+    }
+
+    return featurized;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "../utils.hpp"
+
+// Dataloader settings passed to init()
+// Must match the DataloaderOptions class in python/dataloader.py
+struct DataloaderOptions {
+   public:
+    // Memory-map the data file instead of reading it with 1 ifstream per worker
+    bool useMmap;
+
+    // Visit the data file's batch-sized blocks in a different seeded order every epoch,
+    // and mix the entries of shuffleWindowBatches consecutive blocks of that order
+    bool shuffle;
+    u64 shuffleSeed;
+    u64 shuffleWindowBatches;
+
+    // How many batches each worker owns
+    // A worker keeps up to prefetchBatches - 1 batches decoded ahead of the one being used
+    u64 prefetchBatches;
+
+    // Serve batches in a fixed order (reproducible runs) instead of as soon as they're decoded
+    bool deterministic;
+
+    // Threads decoding each batch, each writing a disjoint range of the batch's entries
+    // Total decoding threads = numThreads passed to init() * threadsPerBatch
+    u64 threadsPerBatch;
+
+    // If 0, workers take turns decoding the data file's blocks
+    // Otherwise, each worker owns a contiguous range of the file and reads it sequentially,
+    // in chunks of about this many bytes (at least 1 batch), wrapping around at the end
+    // With shuffle enabled, the chunk's entries are shuffled (instead of a shuffle window's)
+    u64 contiguousChunkBytes;
+
+    // Ask for transparent huge pages for batches of at least 2 MB (Linux only)
+    bool useHugePages;
+
+    // Batches' features in CSR layout (see Batch) instead of padded to MAX_PIECES_PER_POS
+    bool csrFeatures;
+
+    // Pin every decoding thread to 1 core of cpuList (Linux only), and put the memory each worker
+    // touches (batches, read buffers) on the NUMA node of its core
+    bool pinThreads;
+
+    // Cores to pin decoding threads to, in Linux cpulist format ("0-15,32-47"),
+    // or all cores the process may run on if null or empty
+    const char* cpuList;
+
+    // If >= 0, pin the thread calling init() (the one that must call next_batch())
+    // to the cores of this NUMA node, ideally the one closest to the GPU
+    i64 consumerNumaNode;
+
+    // If > 0, keep up to this many bytes of decoded 1st epoch batches in RAM (see BatchCache),
+    // and serve later epochs from them, reshuffled at batch level (whole batches)
+    // Batches that don't fit are decoded again
+    // Not supported if mixing several data files or with contiguousChunkBytes
+    u64 batchCacheBytes;
+
+    // Trust data files that have a stamp from the converter (see DataStampHeader):
+    // check each block's CRC32C once instead of validating every data entry it decodes
+    // Data files without a stamp are validated as usual
+    bool trustStampedData;
+
+    // Drop data entries when loading them, unless all of these hold (see EntryFilter):
+    //     abs(stm score) <= filterMaxAbsScore
+    //     bit (stm result) of filterResults is set (bit 0 = loss, bit 1 = draw, bit 2 = win)
+    //     filterMinPieces <= pieces <= filterMaxPieces
+    //     side to move not in check, if filterInCheck
+    //     filterMinLegalMoves <= legal moves <= filterMaxLegalMoves
+    // Batches take the next entries kept among those of their window of shuffleWindowBatches
+    // batches instead (see Worker::loadFilteredEntries()), so no entry is served twice, and
+    // a batch number still always maps to the same entries. Batches the filter keeps too few
+    // entries to fill are skipped, so it must keep more than 1 in shuffleWindowBatches entries
+    bool filterEntries;
+    u16 filterMaxAbsScore;
+    u8 filterResults;
+    u8 filterMinPieces;
+    u8 filterMaxPieces;
+    bool filterInCheck;
+    u8 filterMinLegalMoves;
+    u8 filterMaxLegalMoves;
+
+    // If not null or empty, record when each thread reads, decodes, waits and hands off batches
+    // (see TraceSpan), and write it there as Chrome trace JSON at shutdown()
+    const char* tracePath;
+
+    // This process's index (rank) among worldSize training processes loading the same data file,
+    // each serving a different 1/worldSize of every epoch (see Shard)
+    // All ranks must have the same settings except rank, and 1 rank is worldSize 1
+    u64 rank;
+    u64 worldSize;
+
+    // Name of the input feature set to compute (see feature_sets.hpp), or the default one
+    // if null or empty. Pre-featurized data files only have the default one's features
+    const char* featureSet;
+
+};  // struct DataloaderOptions
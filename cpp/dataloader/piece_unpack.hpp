@@ -0,0 +1,220 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cassert>
+
+#if defined(__AVX2__) && defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+#include "../chess/types.hpp"
+#include "../chess/util.hpp"
+#include "../utils.hpp"
+#include "batch.hpp"
+
+// The pieces of a StarwayDataEntry, 1 byte each, in the entry's order (ascending square)
+// Slots after the last piece are 0
+struct UnpackedPieces {
+   public:
+    alignas(32) std::array<u8, MAX_PIECES_PER_POS> mSquares;
+
+    // Lsb is set if the piece is black, other bits are the piece type
+    alignas(32) std::array<u8, MAX_PIECES_PER_POS> mPieces;
+
+    size_t mCount;
+};  // struct UnpackedPieces
+
+#if defined(__AVX2__) && defined(__BMI2__)
+
+// Byte i is 0xFF if bit i is set, else 0
+inline __m256i bitsToByteMask(const u32 bits) {
+    // Byte i gets byte i / 8 of the bits
+    const __m256i spread = _mm256_shuffle_epi8(
+        _mm256_set1_epi32(static_cast<i32>(bits)),
+        _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                         2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3));
+
+    const __m256i bitOfByte = _mm256_set1_epi64x(static_cast<i64>(0x8040'2010'0804'0201ULL));
+
+    return _mm256_cmpeq_epi8(_mm256_and_si256(spread, bitOfByte), bitOfByte);
+}
+
+#endif
+
+// Scalar versions, used if the CPU lacks AVX2 or BMI2, and kept to test the SIMD ones against
+
+constexpr UnpackedPieces unpackPiecesScalar(const u64 occupied, const u128 pieces) {
+    assert(std::popcount(occupied) <= static_cast<i32>(MAX_PIECES_PER_POS));
+
+    UnpackedPieces unpacked;
+    unpacked.mCount = static_cast<size_t>(std::popcount(occupied));
+    unpacked.mSquares = {};
+    unpacked.mPieces = {};
+
+    u64 occ = occupied;
+    u128 piecesLeft = pieces;
+
+    for (size_t i = 0; occ > 0; i++) {
+        unpacked.mSquares[i] = static_cast<u8>(popLsb(occ));
+        unpacked.mPieces[i] = static_cast<u8>(piecesLeft & 0b1111);
+        piecesLeft >>= 4;
+    }
+
+    return unpacked;
+}
+
+constexpr void writeFeaturesScalar(const UnpackedPieces& unpacked,
+                                   const i16 stmOffset,
+                                   const i16 ntmOffset,
+                                   const u8 stmXor,
+                                   const u8 ntmXor,
+                                   i16* featuresStm,
+                                   i16* featuresNtm) {
+    for (size_t i = 0; i < MAX_PIECES_PER_POS; i++) {
+        if (i >= unpacked.mCount) {
+            featuresStm[i] = featuresNtm[i] = -1;
+            continue;
+        }
+
+        const u8 sq = unpacked.mSquares[i];
+        const i16 pieceColor = unpacked.mPieces[i] & 0b1;
+        const i16 pieceType = unpacked.mPieces[i] >> 1;
+
+        // clang-format off
+
+        featuresStm[i] = static_cast<i16>(
+            stmOffset + pieceColor * 384 + pieceType * 64 + (sq ^ stmXor));
+
+        featuresNtm[i] = static_cast<i16>(
+            ntmOffset + (1 - pieceColor) * 384 + pieceType * 64 + (sq ^ ntmXor));
+
+        // clang-format on
+    }
+}
+
+#if defined(__AVX2__) && defined(__BMI2__)
+
+// Same as unpackPiecesScalar(), except that slots after the last piece get the entry's unused
+// nibbles of pieces (0 in valid data entries)
+constexpr UnpackedPieces unpackPiecesSimd(const u64 occupied, const u128 pieces) {
+    assert(std::popcount(occupied) <= static_cast<i32>(MAX_PIECES_PER_POS));
+
+    UnpackedPieces unpacked;
+    unpacked.mCount = static_cast<size_t>(std::popcount(occupied));
+
+    // Squares whose index has bit k set, for each k
+    constexpr std::array<u64, 6> SQUARE_BIT_PLANES = {0xAAAA'AAAA'AAAA'AAAAULL,
+                                                      0xCCCC'CCCC'CCCC'CCCCULL,
+                                                      0xF0F0'F0F0'F0F0'F0F0ULL,
+                                                      0xFF00'FF00'FF00'FF00ULL,
+                                                      0xFFFF'0000'FFFF'0000ULL,
+                                                      0xFFFF'FFFF'0000'0000ULL};
+
+    // Bit i of pext(plane k, occupied) is bit k of the i-th occupied square
+    __m256i squares = _mm256_setzero_si256();
+
+    for (size_t k = 0; k < SQUARE_BIT_PLANES.size(); k++) {
+        const u32 bits = static_cast<u32>(_pext_u64(SQUARE_BIT_PLANES[k], occupied));
+        const __m256i bitK = _mm256_set1_epi8(static_cast<char>(1 << k));
+
+        squares = _mm256_or_si256(squares, _mm256_and_si256(bitsToByteMask(bits), bitK));
+    }
+
+    _mm256_store_si256(reinterpret_cast<__m256i*>(unpacked.mSquares.data()), squares);
+
+    // Nibble i is the low nibble of byte i / 2 if i is even, else the high nibble
+    const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&pieces));
+    const __m128i lowNibbles = _mm_and_si128(packed, _mm_set1_epi8(0x0F));
+    const __m128i highNibbles = _mm_and_si128(_mm_srli_epi16(packed, 4), _mm_set1_epi8(0x0F));
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(unpacked.mPieces.data()),
+                    _mm_unpacklo_epi8(lowNibbles, highNibbles));
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(unpacked.mPieces.data() + 16),
+                    _mm_unpackhi_epi8(lowNibbles, highNibbles));
+
+    return unpacked;
+}
+
+constexpr void writeFeaturesSimd(const UnpackedPieces& unpacked,
+                                 const i16 stmOffset,
+                                 const i16 ntmOffset,
+                                 const u8 stmXor,
+                                 const u8 ntmXor,
+                                 i16* featuresStm,
+                                 i16* featuresNtm) {
+    const __m256i stmOffsetVec = _mm256_set1_epi16(stmOffset);
+    const __m256i ntmOffsetVec = _mm256_set1_epi16(ntmOffset);
+    const __m256i stmXorVec = _mm256_set1_epi16(stmXor);
+    const __m256i ntmXorVec = _mm256_set1_epi16(ntmXor);
+    const __m256i count = _mm256_set1_epi16(static_cast<i16>(unpacked.mCount));
+
+    // 16 pieces at a time
+    for (size_t i = 0; i < MAX_PIECES_PER_POS; i += 16) {
+        const __m256i squares = _mm256_cvtepu8_epi16(
+            _mm_load_si128(reinterpret_cast<const __m128i*>(unpacked.mSquares.data() + i)));
+
+        const __m256i pieces = _mm256_cvtepu8_epi16(
+            _mm_load_si128(reinterpret_cast<const __m128i*>(unpacked.mPieces.data() + i)));
+
+        // pieceType * 64 = (piece & 0b1110) << 5
+        const __m256i pieceTypeTerm =
+            _mm256_slli_epi16(_mm256_and_si256(pieces, _mm256_set1_epi16(0b1110)), 5);
+
+        // pieceColor * 384
+        const __m256i colorTerm =
+            _mm256_mullo_epi16(_mm256_and_si256(pieces, _mm256_set1_epi16(1)),
+                               _mm256_set1_epi16(384));
+
+        const __m256i stm = _mm256_add_epi16(
+            _mm256_add_epi16(_mm256_add_epi16(stmOffsetVec, pieceTypeTerm), colorTerm),
+            _mm256_xor_si256(squares, stmXorVec));
+
+        const __m256i ntm = _mm256_add_epi16(
+            _mm256_add_epi16(_mm256_add_epi16(ntmOffsetVec, pieceTypeTerm),
+                             _mm256_sub_epi16(_mm256_set1_epi16(384), colorTerm)),
+            _mm256_xor_si256(squares, ntmXorVec));
+
+        // Slots i to i + 15, -1 if there's no piece
+        const __m256i slots = _mm256_add_epi16(
+            _mm256_set1_epi16(static_cast<i16>(i)),
+            _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+        const __m256i isPiece = _mm256_cmpgt_epi16(count, slots);
+        const __m256i minusOne = _mm256_set1_epi16(-1);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(featuresStm + i),
+                            _mm256_blendv_epi8(minusOne, stm, isPiece));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(featuresNtm + i),
+                            _mm256_blendv_epi8(minusOne, ntm, isPiece));
+    }
+}
+
+#endif
+
+constexpr UnpackedPieces unpackPieces(const u64 occupied, const u128 pieces) {
+#if defined(__AVX2__) && defined(__BMI2__)
+    return unpackPiecesSimd(occupied, pieces);
+#else
+    return unpackPiecesScalar(occupied, pieces);
+#endif
+}
+
+// Writes the stm and ntm feature indices of the pieces, padded with -1
+// offset + [pieceColor][pieceType][square ^ xor], where each side's offset is the part of its
+// features shared by all pieces (king bucket and in check, see feature_sets.hpp)
+constexpr void writeFeatures(const UnpackedPieces& unpacked,
+                             const i16 stmOffset,
+                             const i16 ntmOffset,
+                             const u8 stmXor,
+                             const u8 ntmXor,
+                             i16* featuresStm,
+                             i16* featuresNtm) {
+#if defined(__AVX2__) && defined(__BMI2__)
+    writeFeaturesSimd(unpacked, stmOffset, ntmOffset, stmXor, ntmXor, featuresStm, featuresNtm);
+#else
+    writeFeaturesScalar(unpacked, stmOffset, ntmOffset, stmXor, ntmXor, featuresStm, featuresNtm);
+#endif
+}
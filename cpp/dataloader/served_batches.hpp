@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include "../utils.hpp"
+
+// First 4 bytes of a dataloader state ("STWS" when read as chars)
+constexpr u32 DATALOADER_STATE_MAGIC = 0x53575453;
+
+constexpr u32 DATALOADER_STATE_VERSION = 1;
+
+// Dataloader state = DataloaderStateHeader, then the u64 batch numbers served above the watermark
+// The batch number alone determines a batch's entries (shuffle epoch included),
+// so the batch numbers served are all that's needed to resume the exact same stream of batches
+struct DataloaderStateHeader {
+   public:
+    u32 mMagic;
+    u32 mVersion;
+
+    // Hash of the settings that change which entries a batch number maps to
+    // A state can only be restored with the same settings and data files
+    u64 mConfigHash;
+
+    u64 mWatermark;
+    u64 mNumServedAbove;
+
+};  // struct DataloaderStateHeader
+
+static_assert(sizeof(DataloaderStateHeader) == 32);  // 32 bytes
+
+// Batch numbers served by next_batch(): every one below the watermark, and a few above it
+// (batches decoded out of order) unless batches are served in deterministic order
+class ServedBatches {
+   private:
+    u64 mWatermark = 0;
+    std::set<u64> mServedAbove;
+
+   public:
+    constexpr ServedBatches() {}
+
+    constexpr ServedBatches(const u64 watermark, const std::vector<u64>& servedAbove) {
+        mWatermark = watermark;
+
+        for (const u64 batchNum : servedAbove) {
+            assert(batchNum > watermark);
+            mServedAbove.insert(batchNum);
+        }
+    }
+
+    constexpr u64 watermark() const { return mWatermark; }
+
+    // Number of batches served
+    constexpr u64 count() const { return mWatermark + mServedAbove.size(); }
+
+    constexpr bool contains(const u64 batchNum) const {
+        return batchNum < mWatermark || mServedAbove.contains(batchNum);
+    }
+
+    constexpr void add(const u64 batchNum) {
+        assert(!contains(batchNum));
+
+        mServedAbove.insert(batchNum);
+
+        while (!mServedAbove.empty() && *mServedAbove.begin() == mWatermark) {
+            mServedAbove.erase(mServedAbove.begin());
+            mWatermark++;
+        }
+    }
+
+    // Number of bytes of the dataloader state serialize() writes
+    constexpr size_t serializedSizeBytes() const {
+        return sizeof(DataloaderStateHeader) + mServedAbove.size() * sizeof(u64);
+    }
+
+    constexpr void serialize(const u64 configHash, u8* state) const {
+        DataloaderStateHeader header;
+        header.mMagic = DATALOADER_STATE_MAGIC;
+        header.mVersion = DATALOADER_STATE_VERSION;
+        header.mConfigHash = configHash;
+        header.mWatermark = mWatermark;
+        header.mNumServedAbove = mServedAbove.size();
+
+        std::memcpy(state, &header, sizeof(header));
+        state += sizeof(header);
+
+        for (const u64 batchNum : mServedAbove) {
+            std::memcpy(state, &batchNum, sizeof(u64));
+            state += sizeof(u64);
+        }
+    }
+
+    // Inverse of serialize(), asserting the state is valid and has the given config hash
+    constexpr static ServedBatches deserialize(const u64 configHash,
+                                               const u8* state,
+                                               const size_t stateSizeBytes) {
+        assert(stateSizeBytes >= sizeof(DataloaderStateHeader));
+
+        DataloaderStateHeader header;
+        std::memcpy(&header, state, sizeof(header));
+
+        assert(header.mMagic == DATALOADER_STATE_MAGIC);
+        assert(header.mVersion == DATALOADER_STATE_VERSION);
+
+        assert(header.mConfigHash == configHash &&
+               "Dataloader state was saved with a different data file, batch size or shuffle "
+               "settings");
+
+        assert(stateSizeBytes == sizeof(header) + header.mNumServedAbove * sizeof(u64));
+
+        std::vector<u64> servedAbove(header.mNumServedAbove);
+        std::memcpy(servedAbove.data(), state + sizeof(header), servedAbove.size() * sizeof(u64));
+
+        return ServedBatches(header.mWatermark, servedAbove);
+    }
+
+};  // class ServedBatches
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cassert>
+
+#include "../utils.hpp"
+
+// This process's share of the batches, if several training processes (ranks) load the same data
+// Every rank serves its own batch numbers 0, 1, 2..., mapped to batch numbers of the whole data
+// (those a single process would serve) that no other rank maps to
+// Of each epoch's batches, rank r gets those at index r, r + worldSize, r + 2 * worldSize...
+// in the epoch, so every rank sees a different 1/worldSize of every epoch, needing no coordination
+// beyond the ranks having the same settings (shuffle seed included)
+// The last epochBatches % worldSize batches of each epoch are served by no rank,
+// so every rank serves as many batches per epoch
+class Shard {
+   private:
+    size_t mRank = 0;
+    size_t mWorldSize = 1;
+
+    // Batches per epoch of the whole data, and of this rank
+    size_t mEpochBatches = 1;
+    size_t mRankEpochBatches = 1;
+
+   public:
+    constexpr Shard() {}
+
+    constexpr Shard(const size_t rank, const size_t worldSize, const size_t epochBatches) {
+        assert(worldSize > 0 && rank < worldSize);
+        assert(epochBatches >= worldSize && "Fewer batches per epoch than ranks");
+
+        mRank = rank;
+        mWorldSize = worldSize;
+        mEpochBatches = epochBatches;
+        mRankEpochBatches = epochBatches / worldSize;
+    }
+
+    constexpr size_t rank() const { return mRank; }
+
+    constexpr size_t worldSize() const { return mWorldSize; }
+
+    // Batches this rank serves per epoch
+    constexpr size_t epochBatches() const { return mRankEpochBatches; }
+
+    // Batch number of the whole data that this rank's batch rankBatchNum is
+    // With 1 rank, the same batch number
+    constexpr u64 globalBatchNum(const u64 rankBatchNum) const {
+        const u64 epoch = rankBatchNum / mRankEpochBatches;
+        const u64 batchInEpoch = rankBatchNum % mRankEpochBatches;
+
+        return epoch * mEpochBatches + batchInEpoch * mWorldSize + mRank;
+    }
+
+};  // class Shard
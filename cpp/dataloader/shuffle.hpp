@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+#include "../utils.hpp"
+
+constexpr u64 splitmix64(u64 x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+constexpr u64 hashCombine(const u64 a, const u64 b) { return splitmix64(a ^ splitmix64(b)); }
+
+constexpr size_t PERMUTATION_ROUNDS = 4;
+
+// A pseudo-random bijection of [0, size) that needs no memory and can be evaluated at any index
+// Feistel network over the smallest even number of bits that fits size, plus cycle walking
+class Permutation {
+   private:
+    u64 mSize;
+    u64 mKey;
+    u32 mHalfBits;
+    u64 mHalfMask;
+
+   public:
+    constexpr Permutation(const u64 size, const u64 key) {
+        assert(size > 0);
+
+        mSize = size;
+        mKey = key;
+
+        const u32 bits = std::max<u32>(2, static_cast<u32>(std::bit_width(size - 1)));
+        mHalfBits = (bits + 1) / 2;
+        mHalfMask = (1ULL << mHalfBits) - 1;
+    }
+
+    constexpr u64 operator()(u64 idx) const {
+        assert(idx < mSize);
+
+        // Cycle walking: re-encrypt until we land back inside [0, size)
+        // The domain is at most 4x size, so this takes few iterations on average
+        do {
+            u64 left = idx >> mHalfBits;
+            u64 right = idx & mHalfMask;
+
+            for (size_t round = 0; round < PERMUTATION_ROUNDS; round++) {
+                const u64 newRight = left ^ (hashCombine(mKey + round, right) & mHalfMask);
+                left = right;
+                right = newRight;
+            }
+
+            idx = (left << mHalfBits) | right;
+        } while (idx >= mSize);
+
+        return idx;
+    }
+};  // class Permutation
+
+// Maps the n-th batch the dataloader serves to the data entries it is made of
+// Each epoch (1 pass over the data file) visits every batch-sized block of the data file once, in
+// a seeded order. Consecutive groups of `windowBlocks` blocks form a shuffle window whose entries
+// are also permuted, so a batch mixes positions from `windowBlocks` different parts of the file
+// without ever holding more than 1 window in memory
+class Shuffler {
+   private:
+    bool mEnabled;
+    u64 mSeed;
+    size_t mBatchSize;
+    size_t mNumBlocks;
+    size_t mWindowBlocks;
+
+   public:
+    constexpr Shuffler() {}
+
+    constexpr Shuffler(const bool enabled,
+                       const u64 seed,
+                       const size_t numEntries,
+                       const size_t batchSize,
+                       const size_t windowBlocks) {
+        assert(batchSize > 0 && numEntries % batchSize == 0);
+        assert(windowBlocks > 0);
+
+        mEnabled = enabled;
+        mSeed = seed;
+        mBatchSize = batchSize;
+        mNumBlocks = numEntries / batchSize;
+        mWindowBlocks = enabled ? std::min(windowBlocks, mNumBlocks) : 1;
+    }
+
+    constexpr bool isEnabled() const { return mEnabled; }
+
+    constexpr size_t windowBlocks() const { return mWindowBlocks; }
+
+    // Batches per epoch
+    constexpr size_t numBlocks() const { return mNumBlocks; }
+
+    constexpr size_t epochOf(const u64 batchNum) const { return batchNum / mNumBlocks; }
+
+    // Fills windowBlocks with the block indices of the shuffle window batch batchNum reads from
+    // Returns the number of blocks in that window (the last window of an epoch may be smaller)
+    constexpr size_t getWindowBlocks(const u64 batchNum, size_t* windowBlocks) const {
+        const size_t epoch = epochOf(batchNum);
+        const size_t batchInEpoch = batchNum % mNumBlocks;
+
+        if (!mEnabled) {
+            windowBlocks[0] = batchInEpoch;
+            return 1;
+        }
+
+        const Permutation blocksPerm(mNumBlocks, hashCombine(mSeed, epoch));
+
+        const size_t firstBlock = batchInEpoch - batchInEpoch % mWindowBlocks;
+        const size_t numBlocks = std::min(mWindowBlocks, mNumBlocks - firstBlock);
+
+        for (size_t i = 0; i < numBlocks; i++) {
+            windowBlocks[i] = blocksPerm(firstBlock + i);
+        }
+
+        return numBlocks;
+    }
+
+    // Permutation of the entries of the shuffle window that batch batchNum reads from
+    // The batch reads window positions [k * batchSize, (k + 1) * batchSize) where
+    // k is the batch's index in the window
+    constexpr Permutation getWindowPermutation(const u64 batchNum, const size_t numBlocks) const {
+        const size_t window = (batchNum % mNumBlocks) / mWindowBlocks;
+        return windowPermutation(epochOf(batchNum), window, numBlocks);
+    }
+
+    constexpr size_t batchIdxInWindow(const u64 batchNum) const {
+        return (batchNum % mNumBlocks) % mWindowBlocks;
+    }
+
+    // Stream position (see getEntryIdx()) of the 1st entry of the shuffle window that stream
+    // position streamPos is in, which identifies that window (see WindowCache)
+    constexpr u64 windowKey(const u64 streamPos) const {
+        const u64 batchNum = streamPos / mBatchSize;
+        return (batchNum - batchIdxInWindow(batchNum)) * mBatchSize;
+    }
+
+    // Data entry index of the streamPos-th entry served, where batch n is the entries
+    // [n * batchSize, (n + 1) * batchSize) of the stream, in the same order as the windows above
+    // Lets a batch take any number of entries from this data file (see DataMix)
+    constexpr size_t getEntryIdx(const u64 streamPos) const {
+        const size_t numEntries = mNumBlocks * mBatchSize;
+        const size_t epoch = streamPos / numEntries;
+        const size_t posInEpoch = streamPos % numEntries;
+
+        if (!mEnabled) {
+            return posInEpoch;
+        }
+
+        const size_t firstBlock = posInEpoch / mBatchSize / mWindowBlocks * mWindowBlocks;
+        const size_t posInWindow = windowPos(streamPos);
+
+        const Permutation blocksPerm(mNumBlocks, hashCombine(mSeed, epoch));
+
+        return blocksPerm(firstBlock + posInWindow / mBatchSize) * mBatchSize +
+               posInWindow % mBatchSize;
+    }
+
+    // Position of the streamPos-th entry served among the entries of its shuffle window's blocks,
+    // in getWindowBlocks() order
+    constexpr size_t windowPos(const u64 streamPos) const {
+        const size_t numEntries = mNumBlocks * mBatchSize;
+        const size_t posInEpoch = streamPos % numEntries;
+        const size_t window = posInEpoch / mBatchSize / mWindowBlocks;
+        const size_t firstBlock = window * mWindowBlocks;
+
+        if (!mEnabled) {
+            return posInEpoch - firstBlock * mBatchSize;
+        }
+
+        const size_t numBlocks = std::min(mWindowBlocks, mNumBlocks - firstBlock);
+
+        return windowPermutation(streamPos / numEntries, window, numBlocks)(
+            posInEpoch - firstBlock * mBatchSize);
+    }
+
+    // With a batch cache (see BatchCache), epochs after the 1st replay the 1st epoch's batches,
+    // whole, in a different seeded order (in the same order if shuffling is disabled)
+    // Returns the 1st epoch batch number that batch batchNum replays, with epochs of epochBatches
+    // batches (numBlocks(), or fewer for a rank's own batch numbers, see Shard)
+    constexpr u64 replayedBatchNum(const u64 batchNum, const size_t epochBatches) const {
+        assert(epochBatches > 0 && epochBatches <= mNumBlocks);
+
+        const size_t epoch = batchNum / epochBatches;
+        const size_t batchInEpoch = batchNum % epochBatches;
+
+        if (epoch == 0 || !mEnabled) {
+            return batchInEpoch;
+        }
+
+        // Window permutations' keys never combine with 0
+        const Permutation batchesPerm(epochBatches, hashCombine(hashCombine(mSeed, epoch), 0));
+        return batchesPerm(batchInEpoch);
+    }
+
+    // Permutation of the entries of a chunk of a contiguous range (see ChunkedRange)
+    // If workers read contiguous ranges, chunks replace shuffle windows
+    // rangeIdx is the worker's index, counting the workers of every rank (see Shard)
+    constexpr Permutation getChunkPermutation(const size_t rangeIdx,
+                                              const size_t epoch,
+                                              const size_t chunkIdx,
+                                              const size_t numBlocks) const {
+        const u64 key =
+            hashCombine(hashCombine(mSeed, epoch), hashCombine(rangeIdx + 1, chunkIdx + 1));
+
+        return Permutation(numBlocks * mBatchSize, key);
+    }
+
+   private:
+    constexpr Permutation windowPermutation(const size_t epoch,
+                                            const size_t window,
+                                            const size_t numBlocks) const {
+        const u64 key = hashCombine(hashCombine(mSeed, epoch), window + 1);
+        return Permutation(numBlocks * mBatchSize, key);
+    }
+
+};  // class Shuffler
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+
+#include "../utils.hpp"
+
+// Cumulative time a worker spent in each stage of decoding batches, summed over its threads
+// (a worker with helper threads can spend more than 1 second per second)
+// If the data file is memory-mapped, most reading happens as page faults while decoding
+// Must match the WorkerStats class in python/dataloader.py
+struct WorkerStats {
+   public:
+    // Reading entries from the data file, and finding those the entry filter keeps
+    u64 readNs;
+
+    // Computing input features and filling the batch, except for the below
+    u64 decodeNs;
+
+    // Generating legal moves and computing their policy indices
+    u64 movegenNs;
+
+    u64 batchesProduced;
+
+    // Of batchesProduced, those copied from the batch cache instead of decoded
+    u64 batchesFromCache;
+
+    // Entries the entry filter dropped (see EntryFilter) between those of the batches produced
+    u64 entriesFiltered;
+
+    // Batches the entry filter kept too few entries to fill, skipped, and the entries kept for them
+    u64 batchesSkipped;
+    u64 entriesSkipped;
+};  // struct WorkerStats
+
+constexpr u64 nanosecondsSince(const std::chrono::steady_clock::time_point start) {
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
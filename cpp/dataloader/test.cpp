@@ -0,0 +1,170 @@
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <print>
+#include <vector>
+
+#include "../utils.hpp"
+#include "batch.hpp"
+#include "compressed_block.hpp"
+#include "piece_unpack.hpp"
+#include "shuffle.hpp"
+
+// A piece of a random color and type in the low nibble
+constexpr u8 randomPiece(const u64 random) {
+    return static_cast<u8>(((random % 6) << 1) | ((random >> 8) & 1));
+}
+
+// pieces of numPieces random pieces on random squares of occupied, with no unused nibbles set
+constexpr std::pair<u64, u128> randomPieces(u64& seed, const size_t numPieces) {
+    u64 occupied = 0;
+
+    while (static_cast<size_t>(std::popcount(occupied)) < numPieces) {
+        occupied |= 1ULL << (splitmix64(seed++) % 64);
+    }
+
+    u128 pieces = 0;
+
+    for (size_t i = 0; i < numPieces; i++) {
+        pieces |= static_cast<u128>(randomPiece(splitmix64(seed++))) << (i * 4);
+    }
+
+    return {occupied, pieces};
+}
+
+// Asserts the SIMD and scalar versions of unpackPieces() and writeFeatures() agree
+// for every feature offset and xor a feature set can give
+constexpr void testPieceUnpack(const u64 occupied, const u128 pieces) {
+    const UnpackedPieces scalar = unpackPiecesScalar(occupied, pieces);
+    const UnpackedPieces unpacked = unpackPieces(occupied, pieces);
+
+    assert(unpacked.mCount == scalar.mCount);
+    assert(unpacked.mSquares == scalar.mSquares);
+    assert(unpacked.mPieces == scalar.mPieces);
+
+    constexpr std::array<i16, 4> OFFSETS = {0, 768, 1536 * 3, 1536 * 3 + 768};
+    constexpr std::array<u8, 4> XORS = {0, 7, 56, 63};
+
+    for (const i16 stmOffset : OFFSETS) {
+        for (const u8 stmXor : XORS) {
+            const i16 ntmOffset = static_cast<i16>(OFFSETS.back() - stmOffset);
+            const u8 ntmXor = static_cast<u8>(stmXor ^ 56);
+
+            std::array<i16, MAX_PIECES_PER_POS> stmScalar, ntmScalar, stm, ntm;
+
+            writeFeaturesScalar(
+                scalar, stmOffset, ntmOffset, stmXor, ntmXor, stmScalar.data(), ntmScalar.data());
+
+            writeFeatures(unpacked, stmOffset, ntmOffset, stmXor, ntmXor, stm.data(), ntm.data());
+
+            assert(stm == stmScalar);
+            assert(ntm == ntmScalar);
+        }
+    }
+}
+
+// Random data entry with the given pieces, side to move, score and best move
+constexpr StarwayDataEntry randomEntry(u64& seed,
+                                       const std::pair<u64, u128>& occupiedAndPieces,
+                                       const bool blackStm,
+                                       const i16 stmScore,
+                                       const u16 bestMove) {
+    StarwayDataEntry entry;
+    entry.mMiscData = static_cast<u32>(splitmix64(seed++));
+    entry.set(Mask::STM, blackStm);
+    entry.mOccupied = occupiedAndPieces.first;
+    entry.mPieces = occupiedAndPieces.second;
+    entry.mStmScore = stmScore;
+    entry.mBestMove = bestMove;
+    return entry;
+}
+
+// Asserts compressBlock() then decompressBlock() gives back the entries,
+// as 1 block and as single-entry blocks
+constexpr void testCompressedBlock(const std::vector<StarwayDataEntry>& entries) {
+    const auto roundTrip = [](const StarwayDataEntry* blockEntries, const size_t count) {
+        std::vector<u8> bytes;
+        compressBlock(blockEntries, count, bytes);
+
+        std::vector<StarwayDataEntry> decompressed(count);
+        decompressBlock(bytes.data(), bytes.size(), count, decompressed.data());
+
+        assert(std::memcmp(decompressed.data(), blockEntries, count * sizeof(StarwayDataEntry)) ==
+               0);
+    };
+
+    roundTrip(entries.data(), entries.size());
+
+    for (const StarwayDataEntry& entry : entries) {
+        roundTrip(&entry, 1);
+    }
+}
+
+int main() {
+#if defined(__AVX2__) && defined(__BMI2__)
+    std::println("Testing SIMD piece unpacking against scalar");
+#else
+    std::println("No AVX2 and BMI2, piece unpacking is scalar only");
+#endif
+
+    // No pieces, kings only, and 32 pieces filling every nibble (high nibble of the last byte too)
+    testPieceUnpack(0, 0);
+    testPieceUnpack((1ULL << 4) | (1ULL << 60), static_cast<u128>(0b1011) << 4 | 0b1010);
+    testPieceUnpack(0xFFFF'0000'0000'FFFFULL, ~static_cast<u128>(0) / 15 * 0b1011);
+    testPieceUnpack(0xFFFF'0000'0000'FFFFULL, ~static_cast<u128>(0) / 15 * 0b0001);
+
+    // Corner squares, and odd counts that leave the last byte's high nibble empty
+    testPieceUnpack(1ULL | (1ULL << 63), 0b0011'0010);
+    testPieceUnpack(1ULL | (1ULL << 7) | (1ULL << 56), 0b1010'0001'1011);
+
+    u64 seed = 0;
+
+    for (size_t i = 0; i < 100'000; i++) {
+        const auto [occupied, pieces] = randomPieces(seed, i % (MAX_PIECES_PER_POS + 1));
+        testPieceUnpack(occupied, pieces);
+    }
+
+    std::println("Testing compressed blocks round trip");
+
+    constexpr u64 LOW_HALF = 0x0000'0000'FFFF'FFFFULL;
+    constexpr u128 PIECES = ~static_cast<u128>(0) / 15 * 0b1010;
+
+    // Extreme scores with either side to move, null best moves, repeated positions,
+    // and every square changing (all 32 pieces jump to the other half of the board)
+    testCompressedBlock({
+        randomEntry(seed, {LOW_HALF, PIECES}, false, 32767, 0),
+        randomEntry(seed, {~LOW_HALF, PIECES}, true, 32767, 0xFFFF),
+        randomEntry(seed, {LOW_HALF, PIECES}, false, -32767, 0),
+        randomEntry(seed, {LOW_HALF, PIECES}, true, -32768, 0),
+        randomEntry(seed, {~LOW_HALF, ~PIECES}, false, -32768, 1),
+        randomEntry(seed, {0, 0}, true, 0, 0),
+        randomEntry(seed, {0, 0}, true, 32767, 0),
+    });
+
+    // Random blocks, some of positions a few pieces apart like consecutive positions of a game
+    for (size_t i = 0; i < 1000; i++) {
+        std::vector<StarwayDataEntry> entries;
+        auto occupiedAndPieces = randomPieces(seed, splitmix64(seed++) % (MAX_PIECES_PER_POS + 1));
+
+        for (size_t j = 0; j < 1 + i % 64; j++) {
+            if (i % 2 == 0 || j % 8 == 0) {
+                occupiedAndPieces =
+                    randomPieces(seed, splitmix64(seed++) % (MAX_PIECES_PER_POS + 1));
+            }
+
+            const u64 random = splitmix64(seed++);
+
+            entries.push_back(randomEntry(seed,
+                                          occupiedAndPieces,
+                                          (random & 1) != 0,
+                                          static_cast<i16>(random >> 16),
+                                          j % 5 == 0 ? 0 : static_cast<u16>(random >> 32)));
+        }
+
+        testCompressedBlock(entries);
+    }
+
+    std::println("Passed!");
+    return 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "../utils.hpp"
+
+// Per-window data of a data file, computed once and shared by the workers decoding their batches:
+// the bytes of shuffle windows that can't be read in place (see DataFile::isZeroCopy()),
+// read and decompressed once, or the entries of filter windows the entry filter keeps
+// Workers claim consecutive batch numbers, so they're all decoding the same 1 or 2 windows,
+// and reading a window once per batch instead would read it windowBlocks times
+// A window is identified by the stream position of its 1st entry (see Shuffler::windowKey())
+template <typename T>
+class WindowCache {
+   private:
+    struct Window {
+       public:
+        u64 key;
+        size_t users = 0;
+        bool loaded = false;
+        u64 lastUse = 0;
+        std::vector<T> items;
+    };
+
+    size_t mMaxWindows;
+
+    std::mutex mMutex;
+    std::condition_variable mWindowLoaded;
+    std::vector<Window> mWindows;
+    u64 mUses = 0;
+
+   public:
+    // Every worker uses up to maxWindowsInUse windows at a time
+    constexpr WindowCache(const size_t numWorkers, const size_t maxWindowsInUse) {
+        assert(numWorkers > 0 && maxWindowsInUse > 0);
+
+        mMaxWindows = numWorkers * maxWindowsInUse;
+
+        // Windows never move, as workers point into them while they're in use
+        mWindows.reserve(mMaxWindows);
+    }
+
+    WindowCache(const WindowCache&) = delete;
+    WindowCache& operator=(const WindowCache&) = delete;
+
+    // Returns the items of window key, which stay valid until release(key)
+    // If the window isn't cached, the calling thread loads it with load(items)
+    // while others wanting it wait, into the least recently used window no one is using
+    // New windows are only allocated if every window is in use
+    template <typename Load>
+    constexpr const std::vector<T>& acquire(const u64 key, Load&& load) {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        const auto it = std::find_if(mWindows.begin(), mWindows.end(), [key](const Window& w) {
+            return w.key == key && (w.loaded || w.users > 0);
+        });
+
+        if (it != mWindows.end()) {
+            Window& window = *it;
+            window.users++;
+            window.lastUse = ++mUses;
+
+            mWindowLoaded.wait(lock, [&window] { return window.loaded; });
+            return window.items;
+        }
+
+        Window* windowPtr = nullptr;
+
+        for (Window& window : mWindows) {
+            if (window.users == 0 && (windowPtr == nullptr || window.lastUse < windowPtr->lastUse)) {
+                windowPtr = &window;
+            }
+        }
+
+        if (windowPtr == nullptr) {
+            assert(mWindows.size() < mMaxWindows);
+            windowPtr = &mWindows.emplace_back();
+        }
+
+        Window& window = *windowPtr;
+        window.key = key;
+        window.users = 1;
+        window.loaded = false;
+        window.lastUse = ++mUses;
+
+        lock.unlock();
+
+        load(window.items);
+
+        lock.lock();
+        window.loaded = true;
+        mWindowLoaded.notify_all();
+
+        return window.items;
+    }
+
+    // The calling thread no longer uses window key
+    constexpr void release(const u64 key) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        const auto it = std::find_if(mWindows.begin(), mWindows.end(), [key](const Window& w) {
+            return w.key == key && w.users > 0;
+        });
+
+        assert(it != mWindows.end());
+        it->users--;
+    }
+
+};  // class WindowCache
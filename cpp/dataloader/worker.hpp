@@ -1,186 +1,1025 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
-#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
 
-#include "../chess/move_gen.hpp"
-#include "../chess/position.hpp"
-#include "../chess/types.hpp"
-#include "../chess/util.hpp"
 #include "../converter/data_entry.hpp"
+#include "../trace.hpp"
 #include "../utils.hpp"
+#include "affinity.hpp"
 #include "batch.hpp"
+#include "batch_cache.hpp"
+#include "batch_queue.hpp"
+#include "chunked_range.hpp"
+#include "data_file.hpp"
+#include "data_mix.hpp"
+#include "entry_filter.hpp"
+#include "feature_sets.hpp"
+#include "featurized_entry.hpp"
+#include "options.hpp"
+#include "served_batches.hpp"
+#include "shard.hpp"
+#include "shuffle.hpp"
+#include "stats.hpp"
+#include "window_cache.hpp"
 
 class Worker {
    private:
-    std::ifstream mDataFile;
-    size_t mFileSizeBytes;
-    Batch mBatch;
+    // An entry of the batch being decoded, if mixing several data sources or filtering entries
+    struct BatchEntry {
+       public:
+        const char* bytes;
+        bool isFeaturized;
+        bool validate;
+        size_t sourceIdx;
+    };
+
+    // A shared window (see WindowCache) of a data source the batch being decoded is read from
+    struct AcquiredWindow {
+       public:
+        size_t sourceIdx;
+        u64 key;
+        const char* bytes;
+    };
+
+    const std::vector<DataSource>* mSources;
+    const DataMix* mDataMix;
+    const Shard* mShard;
+
+    // Data file and shuffler of the 1st data source, the only one unless mixing several
+    const DataFile* mDataFile;
+    const Shuffler* mShuffler;
+
+    size_t mWorkerIdx;
+    size_t mNumWorkers;
+    size_t mBatchSize;
+    bool mCsrFeatures;
+    EntryFilter mFilter;
+    WorkerPlacement mPlacement;
+
+    // Shared by all workers
+    // Workers claim the next batch number to decode from mBatchCursor (unless they read their
+    // own contiguous range), and push decoded batches to mReadyBatches
+    // Batch numbers served before resuming (see set_state()) are skipped
+    std::atomic<u64>* mBatchCursor;
+    BatchQueue* mReadyBatches;
+    const ServedBatches* mServedBeforeResume;
+
+    // Null if not caching batches
+    BatchCache* mBatchCache;
+
+    // Ring of preallocated batches
+    // Decoded, not yet released ones are queued for or being used by the consumer
+    // [batchIdx][sourceIdx] entries of each data source decoded into each batch of the ring,
+    // added to the data source's count once the consumer is served the batch
+    std::vector<Batch> mBatches;
+    std::vector<u64> mEntriesPerSource;
+
+    // [batchIdx] batch numbers skipped before decoding each batch of the ring (see ReadyBatch)
+    // More skipped in a row than every worker claiming every batch of a data source's epoch
+    // means the entry filter keeps too few entries to fill any batch
+    std::vector<std::vector<u64>> mSkippedBatchNums;
+    size_t mMaxSkippedInARow = 0;
+    size_t mBatchesDecoded = 0;
+    size_t mBatchesReleased = 0;
+
+    std::mutex mMutex;
+    std::condition_variable_any mBatchReleased;
+
+    // Block indices and entries (bytes) of the shuffle window the current batch is read from
+    std::vector<size_t> mWindowBlockIdxs;
+    std::vector<const char*> mWindowBlocks;
+
+    // The buffer is only used if the data file isn't memory-mapped or is compressed,
+    // and workers don't share the windows they read
+    DataFileReader mReader;
+    std::vector<char> mReadBuffer;
+
+    // Shared windows and filter windows ((source index, key), see WindowCache)
+    // the batch being decoded is read from, released once the batch is decoded
+    std::vector<AcquiredWindow> mAcquiredWindows;
+    std::vector<std::pair<size_t, u64>> mAcquiredFilterWindows;
+
+    // Only used if workers read contiguous ranges of the data file
+    // This worker decodes batch numbers mWorkerIdx + k * mNumWorkers, k = 0, 1, 2...
+    // With several ranks, the file is split between the workers of every rank (see Shard)
+    std::unique_ptr<ChunkedRange> mRange = nullptr;
+    size_t mRangeIdx = 0;
+    u64 mNextOwnBatchNum = 0;
+
+    // Only used if mixing several data sources or filtering entries
+    // Entries are read in place if their data file is mapped and not compressed,
+    // else from the shared windows of their data source, read through its reader
+    std::vector<BatchEntry> mBatchEntries;
+    std::vector<DataFileReader> mSourceReaders;
+
+    // Only used if filtering entries (see loadFilteredEntries())
+    // With contiguous ranges, chunks are the filter windows, and the positions in the chunk
+    // of the entries the filter keeps are only computed by this worker
+    size_t mFilterWindowBatches = 0;
+    std::vector<u32> mChunkKept;
+    std::optional<u64> mChunkKeptKey = std::nullopt;
+
+    // decodeSlice() specialized for the feature set selected by name (options.featureSet)
+    void (Worker::*mDecodeSlice)(size_t) = nullptr;
+
+    // Batch being decoded, shared with the helper threads
+    // Each thread counts the entries of each data source it decodes into its row of
+    // [sliceIdx][sourceIdx] mSliceEntriesPerSource
+    Batch* mDecodingBatch = nullptr;
+    std::vector<u64> mSliceEntriesPerSource;
+    std::optional<Permutation> mWindowPerm = std::nullopt;
+    size_t mWindowPosOffset = 0;
+    size_t mWindowEntries = 0;
+
+    // Optional helper threads, each decoding a slice of every batch this worker decodes
+    // The worker thread and its helpers meet at the barrier before and after decoding a batch
+    std::unique_ptr<std::barrier<>> mDecodeBarrier = nullptr;
+    bool mStopHelpers = false;
+    std::vector<std::jthread> mHelpers;
+
+    // Cumulative stats (see WorkerStats), added to by the worker thread and its helpers
+    std::atomic<u64> mReadNs = 0;
+    std::atomic<u64> mDecodeNs = 0;
+    std::atomic<u64> mMovegenNs = 0;
+    std::atomic<u64> mBatchesProduced = 0;
+    std::atomic<u64> mBatchesFromCache = 0;
+    std::atomic<u64> mEntriesFiltered = 0;
+    std::atomic<u64> mBatchesSkipped = 0;
+    std::atomic<u64> mEntriesSkipped = 0;
+
+    // Long-lived thread decoding batches into the ring, parked while the ring is full
+    // Declared last so it's stopped and joined before the members it uses are destroyed
+    std::jthread mThread;
 
    public:
-    std::future<Batch*> mFuture;
+    constexpr Worker(const size_t workerIdx,
+                     const size_t numWorkers,
+                     const std::vector<DataSource>& sources,
+                     const DataMix& dataMix,
+                     const Shard& shard,
+                     std::atomic<u64>& batchCursor,
+                     BatchQueue& readyBatches,
+                     const ServedBatches& servedBeforeResume,
+                     BatchCache* batchCache,
+                     const size_t batchSize,
+                     const DataloaderOptions& options,
+                     const WorkerPlacement& placement) {
+        assert(workerIdx < numWorkers);
+        assert(options.prefetchBatches > 0);
+        assert(options.threadsPerBatch > 0 && options.threadsPerBatch <= batchSize);
+
+        assert(!sources.empty() && sources.size() == dataMix.numSources());
+        assert(placement.cpus.empty() || placement.cpus.size() == options.threadsPerBatch);
+
+        mSources = &sources;
+        mDataMix = &dataMix;
+        mShard = &shard;
+        mDataFile = sources[0].dataFile.get();
+        mShuffler = &sources[0].shuffler;
+        mWorkerIdx = workerIdx;
+        mNumWorkers = numWorkers;
+        mBatchSize = batchSize;
+        mCsrFeatures = options.csrFeatures;
+        mFilter = EntryFilter(options);
+
+        const bool knownFeatureSet =
+            visitFeatureSet(featureSetName(options.featureSet), [this]<typename FeatureSet>() {
+                mDecodeSlice = &Worker::decodeSlice<FeatureSet>;
+            });
+
+        assert(knownFeatureSet);
+        mPlacement = placement;
+        mBatchCursor = &batchCursor;
+        mReadyBatches = &readyBatches;
+        mServedBeforeResume = &servedBeforeResume;
+        mBatchCache = batchCache;
+
+        for (size_t i = 0; i < options.prefetchBatches; i++) {
+            mBatches.push_back(Batch(batchSize, options.useHugePages));
+        }
+
+        mEntriesPerSource.resize(options.prefetchBatches * sources.size());
+        mSkippedBatchNums.resize(options.prefetchBatches);
+        mSliceEntriesPerSource.resize(options.threadsPerBatch * sources.size());
+
+        for (size_t i = 0; i < sources.size(); i++) {
+            const size_t epochBatches =
+                sources[i].shuffler.numBlocks() * batchSize / dataMix.countInBatch(i);
+
+            mMaxSkippedInARow = std::max(mMaxSkippedInARow, numWorkers * epochBatches);
+        }
 
-    constexpr Worker(const size_t id,
-                     const std::string& dataFilePath,
-                     const size_t fileSizeBytes,
-                     const size_t batchSize) {
-        // Open data file and seek it to the start of this worker's first batch
-        mDataFile = std::ifstream(dataFilePath, std::ios::binary);
-        assert(mDataFile);
-        mDataFile.seekg(static_cast<i64>(id * batchSize * sizeof(StarwayDataEntry)), std::ios::beg);
+        if (sources.size() > 1 || mFilter.isEnabled()) {
+            mBatchEntries.resize(batchSize);
+        }
+
+        const DataFile& dataFile = *mDataFile;
+        const Shuffler& shuffler = *mShuffler;
+
+        assert((batchCache == nullptr ||
+                (sources.size() == 1 && options.contiguousChunkBytes == 0)) &&
+               "Batch cache is only supported with 1 data file and no contiguous ranges");
+
+        if (sources.size() > 1) {
+            assert(options.contiguousChunkBytes == 0 &&
+                   "Workers can't read contiguous ranges if mixing several data sources");
+
+            mFilterWindowBatches = options.shuffleWindowBatches;
+
+            size_t maxWindowBlocks = 0;
+
+            for (const DataSource& source : sources) {
+                assert((source.dataFile->isZeroCopy() || source.windowCache != nullptr) &&
+                       "Data files that can't be read in place need a window cache");
+
+                // A batch-sized block of a shuffle window may straddle 2 compressed blocks
+                mSourceReaders.push_back(DataFileReader(*source.dataFile, 2));
+
+                maxWindowBlocks = std::max(maxWindowBlocks, source.shuffler.windowBlocks());
+            }
+
+            mWindowBlockIdxs.resize(maxWindowBlocks);
+        } else if (options.contiguousChunkBytes > 0) {
+            // Split the data file's blocks into (numWorkers * ranks) ranges of (almost) equal size
+            const size_t numRanges = numWorkers * shard.worldSize();
+            const size_t numBlocks = dataFile.numEntries() / batchSize;
+
+            mRangeIdx = shard.rank() * numWorkers + workerIdx;
+
+            const size_t firstBlock = numBlocks * mRangeIdx / numRanges;
+            const size_t endBlock = numBlocks * (mRangeIdx + 1) / numRanges;
+
+            mRange = std::make_unique<ChunkedRange>(dataFile,
+                                                    batchSize,
+                                                    firstBlock,
+                                                    endBlock - firstBlock,
+                                                    options.contiguousChunkBytes);
+
+            mWindowBlocks.resize(mRange->chunkBlocks());
 
-        mFileSizeBytes = fileSizeBytes;
-        mBatch = Batch(batchSize);
+            // Start from this worker's 1st batch number at or above the watermark
+            const u64 watermark = servedBeforeResume.watermark();
+            if (watermark > workerIdx) {
+                mNextOwnBatchNum = (watermark - workerIdx + numWorkers - 1) / numWorkers;
+            }
+        } else {
+            mWindowBlockIdxs.resize(shuffler.windowBlocks());
+            mWindowBlocks.resize(shuffler.windowBlocks());
+
+            // Filter windows are the shuffle windows if shuffling
+            mFilterWindowBatches = std::min<size_t>(options.shuffleWindowBatches,
+                                                    shuffler.numBlocks());
+
+            // A batch-sized block of a shuffle window may straddle 2 compressed blocks
+            mReader = DataFileReader(dataFile, 2);
+
+            if (!dataFile.isZeroCopy() && sources[0].windowCache == nullptr) {
+                mReadBuffer.resize(shuffler.windowBlocks() * batchSize * dataFile.entrySizeBytes());
+            }
+        }
+
+        if (options.threadsPerBatch > 1) {
+            mDecodeBarrier = std::make_unique<std::barrier<>>(options.threadsPerBatch);
+        }
+
+        mHelpers.resize(options.threadsPerBatch - 1);
     }
 
-    constexpr Batch* getNextBatch(const size_t numWorkers, const size_t batchSize) {
-        // Our data file's cursor is already at the start of the batch
+    // Start this worker's threads
+    // The worker thread keeps the ring full until the worker is destroyed
+    constexpr void start() {
+        assert(!mThread.joinable());
 
-        assert(mDataFile);
+        for (size_t i = 0; i < mHelpers.size(); i++) {
+            mHelpers[i] = std::jthread([this, i] { runHelper(i + 1); });
+        }
 
-        const auto mirrorVAxis = [](const Square kingSq) -> bool {
-            return static_cast<i32>(fileOf(kingSq)) < static_cast<i32>(File::E);
-        };
+        mThread = std::jthread([this](const std::stop_token stopToken) { run(stopToken); });
+    }
 
-        for (size_t entryIdx = 0; entryIdx < batchSize; entryIdx++) {
-            StarwayDataEntry entry;
+    // Batches of a worker are released in the order they were decoded
+    constexpr bool isNextToRelease(const Batch* batch) {
+        std::lock_guard<std::mutex> lock(mMutex);
 
-            mDataFile.read(reinterpret_cast<char*>(&entry), sizeof(entry));
-            assert(mDataFile);
+        return mBatchesReleased < mBatchesDecoded &&
+               batch == &mBatches[mBatchesReleased % mBatches.size()];
+    }
 
-            entry.validate();
+    // The consumer is done with this worker's oldest decoded batch, so it can be decoded into again
+    constexpr void releaseBatch(const Batch* batch) {
+        std::lock_guard<std::mutex> lock(mMutex);
 
-            Position pos;
-            pos.reset();
+        assert(mBatchesReleased < mBatchesDecoded);
+        assert(batch == &mBatches[mBatchesReleased % mBatches.size()]);
 
-            const bool inCheck = entry.get(Mask::IN_CHECK);
+        mBatchesReleased++;
+        mBatchReleased.notify_one();
+    }
 
-            const Square ourKingSqOriented =
-                static_cast<Square>(entry.get(Mask::OUR_KING_SQ_ORIENTED));
+    constexpr WorkerStats getStats() const {
+        return WorkerStats{mReadNs.load(std::memory_order_relaxed),
+                           mDecodeNs.load(std::memory_order_relaxed),
+                           mMovegenNs.load(std::memory_order_relaxed),
+                           mBatchesProduced.load(std::memory_order_relaxed),
+                           mBatchesFromCache.load(std::memory_order_relaxed),
+                           mEntriesFiltered.load(std::memory_order_relaxed),
+                           mBatchesSkipped.load(std::memory_order_relaxed),
+                           mEntriesSkipped.load(std::memory_order_relaxed)};
+    }
 
-            const Square theirKingSqOriented =
-                static_cast<Square>(entry.get(Mask::THEIR_KING_SQ_ORIENTED));
+    constexpr void resetStats() {
+        mReadNs.store(0, std::memory_order_relaxed);
+        mDecodeNs.store(0, std::memory_order_relaxed);
+        mMovegenNs.store(0, std::memory_order_relaxed);
+        mBatchesProduced.store(0, std::memory_order_relaxed);
+        mBatchesFromCache.store(0, std::memory_order_relaxed);
+        mEntriesFiltered.store(0, std::memory_order_relaxed);
+        mBatchesSkipped.store(0, std::memory_order_relaxed);
+        mEntriesSkipped.store(0, std::memory_order_relaxed);
+    }
 
-            // Flip ranks if black to move
-            // Flip files if that color's king is on left side of board
-            const u8 stmXor = mirrorVAxis(ourKingSqOriented) ? 7 : 0;
-            const u8 ntmXor = mirrorVAxis(theirKingSqOriented) ? 56 ^ 7 : 56;
+   private:
+    // Pins the calling thread (the worker thread if threadIdx is 0, else a helper) to its core,
+    // and makes memory it touches 1st go on this worker's NUMA node
+    constexpr void applyPlacement(const size_t threadIdx) const {
+        if (mPlacement.cpus.empty()) {
+            return;
+        }
 
-            // Iterate pieces
-            size_t piecesSeen = 0;
-            while (entry.mOccupied > 0) {
-                const Square sq = popLsb(entry.mOccupied);
-                const u8 pieceColor = entry.mPieces & 0b1;
-                const u8 pieceType = (entry.mPieces & 0b1110) >> 1;
-                assert(pieceType <= static_cast<u8>(PieceType::King));
+        pinThisThread({mPlacement.cpus[threadIdx]});
 
-                const size_t idx = entryIdx * MAX_PIECES_PER_POS + piecesSeen;
+        if (mPlacement.numaNode >= 0) {
+            preferNumaNode(mPlacement.numaNode);
+        }
+    }
 
-                // clang-format off
+    constexpr void run(const std::stop_token stopToken) {
+        applyPlacement(0);
+        setTraceThreadName("worker " + std::to_string(mWorkerIdx));
 
-                // Set stm feature index which was -1
-                mBatch.activeFeaturesStm[idx]
-                    = inCheck * 768
-                    + static_cast<i16>(pieceColor) * 384
-                    + static_cast<i16>(pieceType) * 64
-                    + static_cast<i16>(static_cast<u8>(sq) ^ stmXor);
+        while (true) {
+            std::unique_lock<std::mutex> lock(mMutex);
 
-                // Set nstm feature index which was -1
-                mBatch.activeFeaturesNtm[idx]
-                    = inCheck * 768
-                    + static_cast<i16>(!pieceColor) * 384
-                    + static_cast<i16>(pieceType) * 64
-                    + static_cast<i16>(static_cast<u8>(sq) ^ ntmXor);
+            // Park until the ring has a free batch or the dataloader shuts down
+            {
+                const TraceSpan span("wait for free batch");
 
-                // clang-format on
+                mBatchReleased.wait(lock, stopToken, [this] {
+                    return mBatchesDecoded - mBatchesReleased < mBatches.size();
+                });
+            }
 
-                pos.togglePiece(
-                    static_cast<Color>(pieceColor), static_cast<PieceType>(pieceType), sq);
+            if (stopToken.stop_requested()) {
+                // Wake the helpers up so they see they must stop too
+                if (!mHelpers.empty()) {
+                    mStopHelpers = true;
+                    mDecodeBarrier->arrive_and_wait();
+                }
 
-                entry.mPieces >>= 4;  // Get the next 4 bits piece ready
-                piecesSeen++;
+                return;
             }
 
-            const size_t idx = entryIdx * MAX_PIECES_PER_POS + piecesSeen;
+            const size_t batchIdx = mBatchesDecoded % mBatches.size();
+            Batch& batch = mBatches[batchIdx];
+            u64* entriesPerSource = &mEntriesPerSource[batchIdx * mSources->size()];
+            std::vector<u64>& skippedBatchNums = mSkippedBatchNums[batchIdx];
+
+            lock.unlock();
 
-            mBatch.activeFeaturesStm[idx] = mBatch.activeFeaturesNtm[idx] = -1;
+            // Only claim a batch number once we have a free batch to decode it into,
+            // so a claimed batch is never stuck behind the consumer
+            // Batch numbers the entry filter can't fill are skipped and handed off with the batch
+            u64 batchNum;
+            skippedBatchNums.clear();
 
-            if (entry.get(Mask::CASTLING_KS)) {
-                pos.enableCastlingRight(pos.mSideToMove, true);
+            while (true) {
+                do {
+                    batchNum = mRange != nullptr
+                                   ? mWorkerIdx + mNextOwnBatchNum++ * mNumWorkers
+                                   : mBatchCursor->fetch_add(1, std::memory_order_relaxed);
+                } while (mServedBeforeResume->contains(batchNum));
+
+                if (decodeBatch(batchNum, batch, entriesPerSource)) {
+                    break;
+                }
+
+                skippedBatchNums.push_back(batchNum);
+
+                assert(skippedBatchNums.size() <= mMaxSkippedInARow &&
+                       "Entry filter keeps too few entries of any filter window to fill a batch");
             }
 
-            if (entry.get(Mask::CASTLING_QS)) {
-                pos.enableCastlingRight(pos.mSideToMove, false);
+            lock.lock();
+            mBatchesDecoded++;
+            lock.unlock();
+
+            mBatchesProduced.fetch_add(1, std::memory_order_relaxed);
+
+            const TraceSpan span("hand-off");
+            mReadyBatches->push(ReadyBatch{batchNum,
+                                           &batch,
+                                           entriesPerSource,
+                                           skippedBatchNums.data(),
+                                           skippedBatchNums.size()});
+        }
+    }
+
+    // Batch number of the whole data (see Shard) that this rank's batch claimedBatchNum is made of
+    // With a batch cache, every epoch is made of the 1st epoch's batches
+    constexpr u64 dataBatchNum(const u64 claimedBatchNum) const {
+        // Contiguous ranges are already split between ranks
+        if (mRange != nullptr) {
+            return claimedBatchNum;
+        }
+
+        const u64 rankBatchNum =
+            mBatchCache != nullptr
+                ? mShuffler->replayedBatchNum(claimedBatchNum, mShard->epochBatches())
+                : claimedBatchNum;
+
+        return mShard->globalBatchNum(rankBatchNum);
+    }
+
+    // Fills entriesPerSource with the entries of each data source decoded into the batch
+    // Returns false, without decoding, if the batch is skipped (see loadFilteredEntries())
+    constexpr bool decodeBatch(const u64 claimedBatchNum, Batch& batch, u64* entriesPerSource) {
+        const u64 batchNum = dataBatchNum(claimedBatchNum);
+
+        if (mBatchCache != nullptr) {
+            const TraceSpan span("load from cache");
+            const auto loadStart = std::chrono::steady_clock::now();
+
+            if (mBatchCache->load(batchNum, batch)) {
+                if (mCsrFeatures) {
+                    batch.compactFeatures(mBatchSize);
+                }
+
+                // Batches are only cached with 1 data source
+                entriesPerSource[0] = mBatchSize;
+
+                mDecodeNs.fetch_add(nanosecondsSince(loadStart), std::memory_order_relaxed);
+                mBatchesFromCache.fetch_add(1, std::memory_order_relaxed);
+                return true;
             }
+        }
+
+        auto readStart = std::chrono::steady_clock::now();
+        bool filled = true;
+        u64 filterMovegenNs = 0;
+
+        {
+            const TraceSpan span("read");
 
-            if (entry.get(Mask::EP_FILE) < 8) {
-                const File epFile = static_cast<File>(entry.get(Mask::EP_FILE));
-                pos.setEpSquare(toSquare(epFile, Rank::Rank6));
+            if (mFilter.isEnabled()) {
+                filled = loadFilteredEntries(batchNum, filterMovegenNs);
+            } else if (mSources->size() > 1) {
+                loadMixedEntries(batchNum);
+            } else if (mRange != nullptr) {
+                loadChunkWindow(batchNum);
+            } else {
+                loadShuffleWindow(batchNum);
             }
+        }
 
-            mBatch.stmScores[entryIdx] = entry.mStmScore;
-            mBatch.stmResults[entryIdx] = static_cast<float>(entry.get(Mask::STM_RESULT)) / 2.0f;
+        // Finding the entries the filter keeps may generate legal moves
+        const u64 readNs = nanosecondsSince(readStart);
+        mReadNs.fetch_add(readNs - std::min(filterMovegenNs, readNs), std::memory_order_relaxed);
+        mMovegenNs.fetch_add(filterMovegenNs, std::memory_order_relaxed);
 
-            // Fill mBatch.legalMovesIdxs slice and mBatch.bestMoveIdx for this data entry
+        if (!filled) {
+            releaseWindows();
+            return false;
+        }
 
-            const auto legalMoves = getLegalMoves(pos);
-            assert(legalMoves.size() > 0 && legalMoves.size() <= MAX_MOVES_PER_POS);
+        // Set up the batch for the helper threads
+        mDecodingBatch = &batch;
 
-            bool bestMoveFound = false;
+        if (mHelpers.empty()) {
+            (this->*mDecodeSlice)(0);
+        } else {
+            // Start the helpers, decode our own slice and wait for the helpers to finish theirs
+            mDecodeBarrier->arrive_and_wait();
+            (this->*mDecodeSlice)(0);
+            mDecodeBarrier->arrive_and_wait();
+        }
 
-            for (size_t i = 0; i < legalMoves.size(); i++) {
-                const MontyformatMove move = legalMoves[i];
+        releaseWindows();
 
-                const MontyformatMove moveOriented =
-                    mirrorVAxis(ourKingSqOriented) ? move.filesFlipped() : move;
+        const size_t numSources = mSources->size();
 
-                const auto [pieceColor, pieceType] = pos.pieceAt(move.getSrc()).value();
+        for (size_t sourceIdx = 0; sourceIdx < numSources; sourceIdx++) {
+            entriesPerSource[sourceIdx] = 0;
 
-                const PieceType ptCaptured = move.isEnPassant() ? PieceType::Pawn
-                                             : move.isCapture()
-                                                 ? pos.pieceAt(move.getDst()).value().second
-                                                 : PieceType::King;
+            for (size_t sliceIdx = 0; sliceIdx <= mHelpers.size(); sliceIdx++) {
+                entriesPerSource[sourceIdx] +=
+                    mSliceEntriesPerSource[sliceIdx * numSources + sourceIdx];
+            }
+        }
 
-                assert(!move.isPromo() || rankOf(move.getDst()) == Rank::Rank8);
+        if (mBatchCache != nullptr || mCsrFeatures) {
+            const TraceSpan span("finish batch");
+            const auto compactStart = std::chrono::steady_clock::now();
 
-                const Square dstForIdx =
-                    move.isPromo() && move.getPromoPt().value() != PieceType::Queen
-                        ? rankFlipped(moveOriented.getDst())
-                        : moveOriented.getDst();
+            // The cache stores batches in padded layout
+            if (mBatchCache != nullptr) {
+                mBatchCache->store(batchNum, batch);
+            }
 
-                // clang-format off
+            if (mCsrFeatures) {
+                batch.compactFeatures(mBatchSize);
+            }
 
-                // [pieceTypeMoved][dstSquare][pieceTypeCaptured]
-                mBatch.legalMovesIdxs[entryIdx * MAX_MOVES_PER_POS + i] =
-                    static_cast<i16>(pieceType) * 64 * 6
-                    + static_cast<i16>(dstForIdx) * 6
-                    + static_cast<i16>(ptCaptured);
+            mDecodeNs.fetch_add(nanosecondsSince(compactStart), std::memory_order_relaxed);
+        }
 
-                // clang-format on
+        // Hint the kernel to start reading the batch this worker likely decodes next
+        // (contiguous ranges are read sequentially, so readahead already covers them,
+        // and mixed batches are scattered entries)
+        if (mRange == nullptr && mSources->size() == 1) {
+            const TraceSpan span("prefetch");
+            readStart = std::chrono::steady_clock::now();
 
-                if (move == MontyformatMove(entry.mBestMove)) {
-                    mBatch.bestMoveIdx[entryIdx] = static_cast<u8>(i);
-                    bestMoveFound = true;
+            const u64 nextBatchNum = dataBatchNum(claimedBatchNum + mNumWorkers);
+
+            const size_t nextNumBlocks =
+                mShuffler->getWindowBlocks(nextBatchNum, mWindowBlockIdxs.data());
+
+            for (size_t i = 0; i < nextNumBlocks; i++) {
+                mDataFile->prefetch(mWindowBlockIdxs[i] * mBatchSize, mBatchSize);
+            }
+
+            mReadNs.fetch_add(nanosecondsSince(readStart), std::memory_order_relaxed);
+        }
+
+        return true;
+    }
+
+    // Points mWindowBlocks to the shuffle window of batch batchNum and sets up its permutation
+    // If workers share windows, the window is only read if no worker has it in the cache
+    constexpr void loadShuffleWindow(const u64 batchNum) {
+        const size_t numBlocks = mShuffler->getWindowBlocks(batchNum, mWindowBlockIdxs.data());
+        const size_t blockSizeBytes = mBatchSize * mDataFile->entrySizeBytes();
+
+        if ((*mSources)[0].windowCache != nullptr) {
+            const char* window =
+                acquireWindow(0, mShuffler->windowKey(batchNum * mBatchSize), mReader);
+
+            for (size_t i = 0; i < numBlocks; i++) {
+                mWindowBlocks[i] = window + i * blockSizeBytes;
+            }
+        } else {
+            for (size_t i = 0; i < numBlocks; i++) {
+                mWindowBlocks[i] = mReader.getEntries(mWindowBlockIdxs[i] * mBatchSize,
+                                                      mBatchSize,
+                                                      mReadBuffer.data() + i * blockSizeBytes);
+            }
+        }
+
+        if (mShuffler->isEnabled()) {
+            mWindowPerm = mShuffler->getWindowPermutation(batchNum, numBlocks);
+            mWindowPosOffset = mShuffler->batchIdxInWindow(batchNum) * mBatchSize;
+            mWindowEntries = numBlocks * mBatchSize;
+        }
+    }
+
+    // Points mWindowBlocks to the chunk of this worker's range that batch batchNum is read from
+    // and sets up its permutation
+    // The k-th batch this worker decodes is the (k % range blocks)-th block of its range
+    constexpr void loadChunkWindow(const u64 batchNum) {
+        const u64 ownBatchNum = batchNum / mNumWorkers;
+        const size_t epoch = ownBatchNum / mRange->numBlocks();
+        const size_t blockInRange = ownBatchNum % mRange->numBlocks();
+        const size_t chunkIdx = blockInRange / mRange->chunkBlocks();
+        const size_t blockInChunk = blockInRange % mRange->chunkBlocks();
+
+        const size_t numBlocks = mRange->loadChunk(chunkIdx, mWindowBlocks.data());
+
+        if (mShuffler->isEnabled()) {
+            mWindowPerm = mShuffler->getChunkPermutation(mRangeIdx, epoch, chunkIdx, numBlocks);
+            mWindowPosOffset = blockInChunk * mBatchSize;
+            mWindowEntries = numBlocks * mBatchSize;
+        } else {
+            // Unshuffled batches are read from mWindowBlocks[0]
+            mWindowBlocks[0] = mWindowBlocks[blockInChunk];
+        }
+    }
+
+    // Returns the shared shuffle window of data source sourceIdx whose 1st entry is stream
+    // position key (see Shuffler::windowKey()), read through reader if no worker has it cached
+    // The window is released once the batch being decoded is decoded
+    constexpr const char* acquireWindow(const size_t sourceIdx,
+                                        const u64 key,
+                                        DataFileReader& reader) {
+        const DataSource& source = (*mSources)[sourceIdx];
+
+        const std::vector<char>& window =
+            source.windowCache->acquire(key, [&](std::vector<char>& bytes) {
+                const TraceSpan span("read window");
+
+                const size_t numBlocks =
+                    source.shuffler.getWindowBlocks(key / mBatchSize, mWindowBlockIdxs.data());
+
+                const size_t blockSizeBytes = mBatchSize * source.dataFile->entrySizeBytes();
+                bytes.resize(source.shuffler.windowBlocks() * blockSizeBytes);
+
+                for (size_t i = 0; i < numBlocks; i++) {
+                    reader.readEntries(mWindowBlockIdxs[i] * mBatchSize,
+                                       mBatchSize,
+                                       bytes.data() + i * blockSizeBytes);
+                }
+            });
+
+        mAcquiredWindows.push_back(AcquiredWindow{sourceIdx, key, window.data()});
+        return window.data();
+    }
+
+    // Releases the shared windows and filter windows the batch being decoded was read from
+    constexpr void releaseWindows() {
+        for (const AcquiredWindow& window : mAcquiredWindows) {
+            (*mSources)[window.sourceIdx].windowCache->release(window.key);
+        }
+
+        for (const auto& [sourceIdx, key] : mAcquiredFilterWindows) {
+            (*mSources)[sourceIdx].filterCache->release(key);
+        }
+
+        mAcquiredWindows.clear();
+        mAcquiredFilterWindows.clear();
+    }
+
+    constexpr DataFileReader& sourceReader(const size_t sourceIdx) {
+        return mSources->size() > 1 ? mSourceReaders[sourceIdx] : mReader;
+    }
+
+    // Bytes of the streamPos-th entry of data source sourceIdx (see Shuffler::getEntryIdx()),
+    // in place if its data file is mapped and not compressed, else in the shared window it's in
+    constexpr const char* streamEntry(const size_t sourceIdx, const u64 streamPos) {
+        const DataSource& source = (*mSources)[sourceIdx];
+
+        if (source.windowCache == nullptr) {
+            return sourceReader(sourceIdx).getEntries(
+                source.shuffler.getEntryIdx(streamPos), 1, nullptr);
+        }
+
+        const u64 key = source.shuffler.windowKey(streamPos);
+
+        // Entries are mostly taken in stream order, so their window is usually the last acquired
+        const auto it = std::find_if(
+            mAcquiredWindows.rbegin(), mAcquiredWindows.rend(), [&](const AcquiredWindow& w) {
+                return w.sourceIdx == sourceIdx && w.key == key;
+            });
+
+        const char* window = it != mAcquiredWindows.rend()
+                                 ? it->bytes
+                                 : acquireWindow(sourceIdx, key, sourceReader(sourceIdx));
+
+        return window + source.shuffler.windowPos(streamPos) * source.dataFile->entrySizeBytes();
+    }
+
+    // Points mBatchEntries to the entries of batch batchNum
+    // Batch n takes entries [n * count, (n + 1) * count) of each data source's shuffler order,
+    // which span at most 2 shuffle windows of it
+    constexpr void loadMixedEntries(const u64 batchNum) {
+        for (size_t i = 0; i < mSources->size(); i++) {
+            const DataSource& source = (*mSources)[i];
+            const size_t count = mDataMix->countInBatch(i);
+            const size_t firstEntryIdx = mDataMix->firstIdxInBatch(i);
+
+            for (size_t j = 0; j < count; j++) {
+                mBatchEntries[firstEntryIdx + j] = BatchEntry{streamEntry(i, batchNum * count + j),
+                                                              source.dataFile->isFeaturized(),
+                                                              validateEntries(i),
+                                                              i};
+            }
+        }
+    }
+
+    // Points mBatchEntries to the entries of batch batchNum that the entry filter keeps
+    // Consecutive batch numbers are grouped in filter windows of mFilterWindowBatches batches
+    // (with 1 data source, those of an epoch, so the shuffle windows if shuffling)
+    // Each data source's share of the k-th batch of a filter window is the k-th share of
+    // the window's entries of that source the filter keeps, in stream order
+    // (with contiguous ranges, chunks are the filter windows, see loadFilteredChunkEntries())
+    // So no entry is served twice, and a batch number still always maps to the same entries
+    // Returns false if a data source has too few entries kept left, in which case the batch
+    // is skipped, and the entries kept for it count as skipped too
+    // Adds the time spent generating legal moves to check entries to movegenNs
+    constexpr bool loadFilteredEntries(const u64 batchNum, u64& movegenNs) {
+        if (mRange != nullptr) {
+            return loadFilteredChunkEntries(batchNum, movegenNs);
+        }
+
+        u64 firstBatchNum = batchNum - batchNum % mFilterWindowBatches;
+        size_t numBatches = mFilterWindowBatches;
+
+        if (mSources->size() == 1) {
+            const size_t firstBatchInEpoch =
+                batchNum % mShuffler->numBlocks() / mFilterWindowBatches * mFilterWindowBatches;
+
+            firstBatchNum = batchNum - batchNum % mShuffler->numBlocks() + firstBatchInEpoch;
+            numBatches = std::min(numBatches, mShuffler->numBlocks() - firstBatchInEpoch);
+        }
+
+        const size_t batchInWindow = batchNum - firstBatchNum;
+        std::vector<const std::vector<u32>*> keptPerSource;
+        size_t entriesKept = 0;
+        u64 entriesFiltered = 0;
+
+        for (size_t i = 0; i < mSources->size(); i++) {
+            const size_t count = mDataMix->countInBatch(i);
+            const u64 firstStreamPos = firstBatchNum * count;
+            const size_t windowEntries = numBatches * count;
+
+            const std::vector<u32>& kept =
+                (*mSources)[i].filterCache->acquire(firstStreamPos, [&](std::vector<u32>& items) {
+                    const TraceSpan span("filter window");
+                    items.clear();
+
+                    for (size_t pos = 0; pos < windowEntries; pos++) {
+                        if (filterKeeps(streamEntry(i, firstStreamPos + pos), i, movegenNs)) {
+                            items.push_back(static_cast<u32>(pos));
+                        }
+                    }
+                });
+
+            mAcquiredFilterWindows.emplace_back(i, firstStreamPos);
+            keptPerSource.push_back(&kept);
+
+            const auto [numKept, numFiltered] =
+                keptShare(kept, windowEntries, batchInWindow, count);
+            entriesKept += numKept;
+            entriesFiltered += numFiltered;
+        }
+
+        mEntriesFiltered.fetch_add(entriesFiltered, std::memory_order_relaxed);
+
+        if (entriesKept < mBatchSize) {
+            mBatchesSkipped.fetch_add(1, std::memory_order_relaxed);
+            mEntriesSkipped.fetch_add(entriesKept, std::memory_order_relaxed);
+            return false;
+        }
+
+        for (size_t i = 0; i < mSources->size(); i++) {
+            const DataSource& source = (*mSources)[i];
+            const size_t count = mDataMix->countInBatch(i);
+            const size_t firstEntryIdx = mDataMix->firstIdxInBatch(i);
+            const std::vector<u32>& kept = *keptPerSource[i];
+
+            for (size_t j = 0; j < count; j++) {
+                const u64 streamPos = firstBatchNum * count + kept[batchInWindow * count + j];
+
+                mBatchEntries[firstEntryIdx + j] = BatchEntry{streamEntry(i, streamPos),
+                                                              source.dataFile->isFeaturized(),
+                                                              validateEntries(i),
+                                                              i};
+            }
+        }
+
+        return true;
+    }
+
+    // loadFilteredEntries() with the chunks of this worker's range as filter windows
+    constexpr bool loadFilteredChunkEntries(const u64 batchNum, u64& movegenNs) {
+        const u64 ownBatchNum = batchNum / mNumWorkers;
+        const size_t epoch = ownBatchNum / mRange->numBlocks();
+        const size_t blockInRange = ownBatchNum % mRange->numBlocks();
+        const size_t chunkIdx = blockInRange / mRange->chunkBlocks();
+        const size_t blockInChunk = blockInRange % mRange->chunkBlocks();
+
+        const size_t numBlocks = mRange->loadChunk(chunkIdx, mWindowBlocks.data());
+        const size_t entrySizeBytes = mDataFile->entrySizeBytes();
+
+        if (mShuffler->isEnabled()) {
+            mWindowPerm = mShuffler->getChunkPermutation(mRangeIdx, epoch, chunkIdx, numBlocks);
+        }
+
+        const auto chunkEntry = [&](const size_t pos) {
+            const size_t chunkPos = mShuffler->isEnabled() ? (*mWindowPerm)(pos) : pos;
+            return mWindowBlocks[chunkPos / mBatchSize] + chunkPos % mBatchSize * entrySizeBytes;
+        };
+
+        // Every batch of the chunk (in this epoch) has the same own batch number of its 1st block
+        const u64 chunkKey = ownBatchNum - blockInChunk;
+
+        if (mChunkKeptKey != chunkKey) {
+            const TraceSpan span("filter window");
+            mChunkKept.clear();
+
+            for (size_t pos = 0; pos < numBlocks * mBatchSize; pos++) {
+                if (filterKeeps(chunkEntry(pos), 0, movegenNs)) {
+                    mChunkKept.push_back(static_cast<u32>(pos));
                 }
             }
 
-            assert(bestMoveFound);
+            mChunkKeptKey = chunkKey;
+        }
+
+        const auto [numKept, numFiltered] =
+            keptShare(mChunkKept, numBlocks * mBatchSize, blockInChunk, mBatchSize);
+
+        mEntriesFiltered.fetch_add(numFiltered, std::memory_order_relaxed);
+
+        if (numKept < mBatchSize) {
+            mBatchesSkipped.fetch_add(1, std::memory_order_relaxed);
+            mEntriesSkipped.fetch_add(numKept, std::memory_order_relaxed);
+            return false;
+        }
+
+        for (size_t j = 0; j < mBatchSize; j++) {
+            mBatchEntries[j] = BatchEntry{chunkEntry(mChunkKept[blockInChunk * mBatchSize + j]),
+                                          mDataFile->isFeaturized(),
+                                          validateEntries(0),
+                                          0};
+        }
+
+        return true;
+    }
+
+    // Of the entries kept[batchInWindow * count, (batchInWindow + 1) * count) of a filter window
+    // of windowEntries entries, returns how many there are, and how many entries the filter
+    // dropped between them and the previous batch's (until the window's end, for the last ones)
+    static constexpr std::pair<size_t, u64> keptShare(const std::vector<u32>& kept,
+                                                      const size_t windowEntries,
+                                                      const size_t batchInWindow,
+                                                      const size_t count) {
+        const size_t first = batchInWindow * count;
+
+        if (first > 0 && kept.size() <= first) {
+            return {0, 0};
+        }
+
+        const size_t numKept = std::min(count, kept.size() - first);
+        const size_t startPos = first == 0 ? 0 : kept[first - 1] + 1;
+        const size_t endPos =
+            first + count < kept.size() ? kept[first + count - 1] + 1 : windowEntries;
+
+        return {numKept, endPos - startPos - numKept};
+    }
+
+    // Whether the entry filter keeps an entry of data source sourceIdx
+    // Entries of Starway data files that don't store their legal moves count have them
+    // generated to count them, if the filter checks it, adding the time it takes to movegenNs
+    constexpr bool filterKeeps(const char* entryBytes, const size_t sourceIdx, u64& movegenNs) {
+        if ((*mSources)[sourceIdx].dataFile->isFeaturized()) {
+            return mFilter.accepts(*reinterpret_cast<const FeaturizedEntry*>(entryBytes));
+        }
+
+        const auto* entry = reinterpret_cast<const StarwayDataEntry*>(entryBytes);
+
+        if (!mFilter.mayAccept(*entry)) {
+            return false;
+        }
+
+        if (mFilter.isExact(*entry)) {
+            return true;
+        }
+
+        if (validateEntries(sourceIdx)) {
+            entry->validate();
+        }
+
+        return mFilter.acceptsLegalMoves(countLegalMoves(*entry, &movegenNs));
+    }
+
+    // Decodes the sliceIdx-th of the (helpers + 1) entry ranges of the batch being decoded
+    // With the features of FeatureSet
+    template <typename FeatureSet>
+    constexpr void decodeSlice(const size_t sliceIdx) {
+        const size_t numSlices = mHelpers.size() + 1;
+        const size_t firstEntryIdx = mBatchSize * sliceIdx / numSlices;
+        const size_t endEntryIdx = mBatchSize * (sliceIdx + 1) / numSlices;
+
+        const size_t entrySizeBytes = mDataFile->entrySizeBytes();
+        const bool isFeaturized = mDataFile->isFeaturized();
+        const bool validate = validateEntries(0);
 
-            for (size_t i = legalMoves.size(); i < MAX_MOVES_PER_POS; i++) {
-                mBatch.legalMovesIdxs[entryIdx * MAX_MOVES_PER_POS + i] = -1;
+        TraceSpan span("decode");
+        const auto sliceStart = std::chrono::steady_clock::now();
+        u64 movegenNs = 0;
+
+        u64* entriesPerSource = &mSliceEntriesPerSource[sliceIdx * mSources->size()];
+        std::fill(entriesPerSource, entriesPerSource + mSources->size(), 0);
+
+        if (!mBatchEntries.empty()) {
+            for (size_t entryIdx = firstEntryIdx; entryIdx < endEntryIdx; entryIdx++) {
+                const BatchEntry& entry = mBatchEntries[entryIdx];
+
+                decodeEntry<FeatureSet>(
+                    entry.bytes, entry.isFeaturized, entry.validate, entryIdx, movegenNs);
+
+                entriesPerSource[entry.sourceIdx]++;
+            }
+        } else if (mShuffler->isEnabled()) {
+            for (size_t entryIdx = firstEntryIdx; entryIdx < endEntryIdx; entryIdx++) {
+                const size_t windowPos = (*mWindowPerm)(mWindowPosOffset + entryIdx);
+                const char* block = mWindowBlocks[windowPos / mBatchSize];
+
+                decodeEntry<FeatureSet>(block + windowPos % mBatchSize * entrySizeBytes,
+                                        isFeaturized,
+                                        validate,
+                                        entryIdx,
+                                        movegenNs);
+            }
+
+            entriesPerSource[0] = endEntryIdx - firstEntryIdx;
+        } else {
+            for (size_t entryIdx = firstEntryIdx; entryIdx < endEntryIdx; entryIdx++) {
+                decodeEntry<FeatureSet>(mWindowBlocks[0] + entryIdx * entrySizeBytes,
+                                        isFeaturized,
+                                        validate,
+                                        entryIdx,
+                                        movegenNs);
             }
+
+            entriesPerSource[0] = endEntryIdx - firstEntryIdx;
         }
 
-        // Set data file cursor to start of this worker's next batch
+        const u64 sliceNs = nanosecondsSince(sliceStart);
+        mDecodeNs.fetch_add(sliceNs - std::min(movegenNs, sliceNs), std::memory_order_relaxed);
+        mMovegenNs.fetch_add(movegenNs, std::memory_order_relaxed);
+
+        // Legal moves are generated per entry, too often to trace each
+        span.setArg("movegen ms", static_cast<double>(movegenNs) / 1e6);
+    }
+
+    constexpr void runHelper(const size_t sliceIdx) {
+        applyPlacement(sliceIdx);
+
+        setTraceThreadName("worker " + std::to_string(mWorkerIdx) + " helper " +
+                           std::to_string(sliceIdx));
+
+        while (true) {
+            // Wait for the worker thread to set up the next batch
+            mDecodeBarrier->arrive_and_wait();
+
+            if (mStopHelpers) {
+                return;
+            }
+
+            (this->*mDecodeSlice)(sliceIdx);
+
+            // Tell the worker thread we're done with our slice
+            mDecodeBarrier->arrive_and_wait();
+        }
+    }
+
+    // Entries of a trusted data file were validated by the converter (unless debug build)
+    constexpr bool validateEntries(const size_t sourceIdx) const {
+        return !(*mSources)[sourceIdx].dataFile->isTrusted() || DEBUG_BUILD;
+    }
+
+    // Fills the batch being decoded at entryIdx with a data entry
+    // Adds the time spent on its legal moves and policy indices to movegenNs
+    template <typename FeatureSet>
+    constexpr void decodeEntry(const char* entryBytes,
+                               const bool isFeaturized,
+                               const bool validate,
+                               const size_t entryIdx,
+                               u64& movegenNs) {
+        if (isFeaturized) {
+            const auto* featurized = reinterpret_cast<const FeaturizedEntry*>(entryBytes);
+
+            if (validate) {
+                featurized->validate();
+            }
+
+            fillEntry(*featurized, *mDecodingBatch, entryIdx);
+            return;
+        }
+
+        const auto* entry = reinterpret_cast<const StarwayDataEntry*>(entryBytes);
+        fillEntry(featurize<FeatureSet>(*entry, &movegenNs, validate), *mDecodingBatch, entryIdx);
+    }
 
-        i64 filePos = mDataFile.tellg();
-        assert(filePos > 0);
+    constexpr void fillEntry(const FeaturizedEntry& featurized,
+                             Batch& batch,
+                             const size_t entryIdx) {
+        std::copy(std::begin(featurized.mActiveFeaturesStm),
+                  std::end(featurized.mActiveFeaturesStm),
+                  batch.activeFeaturesStm + entryIdx * MAX_PIECES_PER_POS);
 
-        // Minus 1 because we just parsed a batch
-        filePos += (numWorkers - 1) * batchSize * sizeof(StarwayDataEntry);
+        std::copy(std::begin(featurized.mActiveFeaturesNtm),
+                  std::end(featurized.mActiveFeaturesNtm),
+                  batch.activeFeaturesNtm + entryIdx * MAX_PIECES_PER_POS);
 
-        mDataFile.seekg(filePos % static_cast<i64>(mFileSizeBytes), std::ios::beg);
+        std::copy(std::begin(featurized.mLegalMovesIdxs),
+                  std::end(featurized.mLegalMovesIdxs),
+                  batch.legalMovesIdxs + entryIdx * MAX_MOVES_PER_POS);
 
-        return &mBatch;
+        batch.stmScores[entryIdx] = static_cast<float>(featurized.mStmScore);
+        batch.stmResults[entryIdx] = static_cast<float>(featurized.mStmResult) / 2.0f;
+        batch.bestMoveIdx[entryIdx] = static_cast<i64>(featurized.mBestMoveIdx);
     }
 };  // class Worker
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <print>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+
+// Opt-in tracing of spans (named begin/end intervals) of every thread, written as
+// Chrome trace event JSON, to view in https://ui.perfetto.dev or chrome://tracing
+// Each thread records its spans into its own buffer, so recording takes no lock
+// While tracing is off, a TraceSpan costs 1 relaxed atomic load
+
+// About 100 MB per thread; later spans of a thread are dropped
+constexpr size_t MAX_TRACE_SPANS_PER_THREAD = 1 << 22;
+
+struct TraceEvent {
+   public:
+    const char* name;
+    u64 startNs;
+    u64 endNs;
+
+    // Optional extra value shown with the span (null name if none)
+    const char* argName;
+    double argValue;
+};
+
+// Spans of 1 thread, only written to by that thread
+// Outlives the thread, so its spans can be written after it's joined
+struct TraceBuffer {
+   public:
+    u64 threadId;
+    std::string threadName;
+    std::vector<TraceEvent> events;
+    u64 numDropped = 0;
+    std::atomic<bool> threadExited = false;
+};
+
+class Tracer {
+   private:
+    std::atomic<bool> mEnabled = false;
+    std::chrono::steady_clock::time_point mStart;
+
+    std::mutex mMutex;
+    std::vector<std::unique_ptr<TraceBuffer>> mBuffers;
+    u64 mNextThreadId = 1;
+
+    // Copies of span names that aren't string literals (from Python), so they outlive the call
+    std::set<std::string> mNames;
+
+   public:
+    constexpr bool isEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+    // Nanoseconds since start()
+    constexpr u64 nowNs() const {
+        const auto elapsed = std::chrono::steady_clock::now() - mStart;
+        return static_cast<u64>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    // Call before starting the threads to trace
+    constexpr void start() {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mStart = std::chrono::steady_clock::now();
+        mEnabled.store(true, std::memory_order_relaxed);
+    }
+
+    constexpr TraceBuffer* newBuffer() {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto buffer = std::make_unique<TraceBuffer>();
+        buffer->threadId = mNextThreadId++;
+        buffer->threadName = "thread " + std::to_string(buffer->threadId);
+        buffer->events.reserve(4096);
+
+        mBuffers.push_back(std::move(buffer));
+        return mBuffers.back().get();
+    }
+
+    constexpr const char* internName(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mNames.insert(name).first->c_str();
+    }
+
+    // Writes every thread's spans to a JSON file and stops tracing
+    // Call after joining the traced threads (except the calling one)
+    constexpr void stop(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mEnabled.store(false, std::memory_order_relaxed);
+
+        std::ofstream file(path);
+        assert(file);
+
+        const auto escaped = [](const std::string& str) {
+            std::string result;
+
+            for (const char c : str) {
+                if (c == '"' || c == '\\') {
+                    result += '\\';
+                }
+
+                result += c;
+            }
+
+            return result;
+        };
+
+        // Chrome trace timestamps are in microseconds
+        const auto micros = [](const u64 ns) { return static_cast<double>(ns) / 1000.0; };
+
+        std::println(file, "{{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+        size_t numEvents = 0;
+        u64 numDropped = 0;
+
+        for (const std::unique_ptr<TraceBuffer>& buffer : mBuffers) {
+            if (buffer->events.empty()) {
+                continue;
+            }
+
+            std::println(file,
+                         "{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": {}, "
+                         "\"args\": {{\"name\": \"{}\"}}}},",
+                         buffer->threadId,
+                         escaped(buffer->threadName));
+
+            for (const TraceEvent& event : buffer->events) {
+                std::print(file,
+                           "{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, "
+                           "\"ts\": {:.3f}, \"dur\": {:.3f}",
+                           escaped(event.name),
+                           buffer->threadId,
+                           micros(event.startNs),
+                           micros(event.endNs - event.startNs));
+
+                if (event.argName != nullptr) {
+                    std::print(file,
+                               ", \"args\": {{\"{}\": {:.3f}}}",
+                               escaped(event.argName),
+                               event.argValue);
+                }
+
+                std::println(file, "}},");
+                numEvents++;
+            }
+
+            numDropped += buffer->numDropped;
+        }
+
+        // Trailing comma above, so end with an empty metadata event
+        std::println(file, "{{\"name\": \"end\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0}}");
+        std::println(file, "]}}");
+
+        file.close();
+        assert(file);
+
+        std::println("Trace: wrote {} spans to {}", numEvents, path);
+
+        if (numDropped > 0) {
+            std::println("Trace: dropped {} spans of threads whose buffer was full", numDropped);
+        }
+
+        // Exited threads' buffers are no longer needed, live threads keep theirs
+        std::erase_if(mBuffers, [](const std::unique_ptr<TraceBuffer>& buffer) {
+            return buffer->threadExited.load(std::memory_order_acquire);
+        });
+
+        for (std::unique_ptr<TraceBuffer>& buffer : mBuffers) {
+            buffer->events.clear();
+            buffer->numDropped = 0;
+        }
+    }
+
+};  // class Tracer
+
+inline Tracer gTracer;
+
+// The calling thread's buffer, created on its 1st span
+struct ThreadTraceBuffer {
+   public:
+    TraceBuffer* buffer = nullptr;
+
+    constexpr ~ThreadTraceBuffer() {
+        if (buffer != nullptr) {
+            buffer->threadExited.store(true, std::memory_order_release);
+        }
+    }
+
+    constexpr TraceBuffer& get() {
+        if (buffer == nullptr) {
+            buffer = gTracer.newBuffer();
+        }
+
+        return *buffer;
+    }
+};
+
+inline thread_local ThreadTraceBuffer tlTraceBuffer;
+
+// Name the calling thread has in the trace
+inline void setTraceThreadName(const std::string& name) {
+    if (gTracer.isEnabled()) {
+        tlTraceBuffer.get().threadName = name;
+    }
+}
+
+inline void recordTraceEvent(const TraceEvent& event) {
+    TraceBuffer& buffer = tlTraceBuffer.get();
+
+    if (buffer.events.size() < MAX_TRACE_SPANS_PER_THREAD) {
+        buffer.events.push_back(event);
+    } else {
+        buffer.numDropped++;
+    }
+}
+
+// Records a span from its construction to its destruction, if tracing
+// name must outlive the trace (a string literal or from Tracer::internName())
+class TraceSpan {
+   private:
+    bool mEnabled;
+    TraceEvent mEvent;
+
+   public:
+    constexpr explicit TraceSpan(const char* name) {
+        mEnabled = gTracer.isEnabled();
+
+        if (mEnabled) {
+            mEvent = TraceEvent{name, gTracer.nowNs(), 0, nullptr, 0.0};
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    constexpr ~TraceSpan() {
+        if (mEnabled) {
+            mEvent.endNs = gTracer.nowNs();
+            recordTraceEvent(mEvent);
+        }
+    }
+
+    // Shows a value with the span, such as the time spent in a part of it
+    // argName must outlive the trace, like the span's name
+    constexpr void setArg(const char* argName, const double argValue) {
+        mEvent.argName = argName;
+        mEvent.argValue = argValue;
+    }
+
+};  // class TraceSpan
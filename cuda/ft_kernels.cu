@@ -73,3 +73,65 @@ __global__ void ft_backward_kernel(
         atomicAdd(&weightsGrad[featureIdx * hiddenSize + hiddenNeuronIdx], myOutputGrad);
     }
 }
+
+// CSR layout: the active features of entry i are activeFeatures[offsets[i]..offsets[i + 1])
+
+__global__ void ft_forward_csr_kernel(
+    const int* __restrict__ activeFeatures,  // [NUM_ACTIVE_FEATURES]
+    const int* __restrict__ offsets,         // [BATCH_SIZE + 1]
+    const float* __restrict__ weights,       // [INPUT_SIZE, HIDDEN_SIZE]
+    const float* __restrict__ biases,        // [HIDDEN_SIZE]
+    float* __restrict__ output)              // uninitialized, [BATCH_SIZE, HIDDEN_SIZE]
+{
+    // 1 block per data entry in the batch
+    const int batchSize = gridDim.x;
+    const int entryIdx = blockIdx.x;
+
+    // 1 thread per hidden neuron
+    const int hiddenSize = blockDim.x;
+    const int hiddenNeuronIdx = threadIdx.x;
+
+    if (entryIdx >= batchSize || hiddenNeuronIdx >= hiddenSize) {
+        return;
+    }
+
+    float sum = biases[hiddenNeuronIdx];
+
+    for (int i = offsets[entryIdx]; i < offsets[entryIdx + 1]; i++) {
+        sum += weights[activeFeatures[i] * hiddenSize + hiddenNeuronIdx];
+    }
+
+    output[entryIdx * hiddenSize + hiddenNeuronIdx] = sum;
+}
+
+__global__ void ft_backward_csr_kernel(
+    const int* __restrict__ activeFeatures,  // [NUM_ACTIVE_FEATURES]
+    const int* __restrict__ offsets,         // [BATCH_SIZE + 1]
+    float* __restrict__ weightsGrad,         // zeroed, [INPUT_SIZE, HIDDEN_SIZE]
+    float* __restrict__ biasesGrad,          // zeroed, [HIDDEN_SIZE]
+    const float* __restrict__ outputGrad)    // [BATCH_SIZE, HIDDEN_SIZE]
+{
+    // 1 block per data entry in the batch
+    const int batchSize = gridDim.x;
+    const int entryIdx = blockIdx.x;
+
+    // 1 thread per hidden neuron
+    const int hiddenSize = blockDim.x;
+    const int hiddenNeuronIdx = threadIdx.x;
+
+    if (entryIdx >= batchSize || hiddenNeuronIdx >= hiddenSize) {
+        return;
+    }
+
+    const float myOutputGrad = outputGrad[entryIdx * hiddenSize + hiddenNeuronIdx];
+
+    if (myOutputGrad == 0.0f) {
+        return;
+    }
+
+    atomicAdd(&biasesGrad[hiddenNeuronIdx], myOutputGrad);
+
+    for (int i = offsets[entryIdx]; i < offsets[entryIdx + 1]; i++) {
+        atomicAdd(&weightsGrad[activeFeatures[i] * hiddenSize + hiddenNeuronIdx], myOutputGrad);
+    }
+}
@@ -1,45 +1,91 @@
 from settings import *
 import ctypes
+import math
 import numpy as np
 import torch
 
 MAX_PIECES_PER_POS = 32
 
+# Addresses of the batch arenas registered with CUDA as pinned memory
+pinned_arenas = set()
+
+# Must match the Batch struct in cpp/dataloader/batch.hpp
 class Batch(ctypes.Structure):
     _fields_ = [
-        ('active_features_stm', ctypes.POINTER(ctypes.c_int16)),
-        ('active_features_ntm', ctypes.POINTER(ctypes.c_int16)),
-        ('stm_scores', ctypes.POINTER(ctypes.c_int16)),
+        ('active_features_stm', ctypes.POINTER(ctypes.c_int32)),
+        ('active_features_ntm', ctypes.POINTER(ctypes.c_int32)),
+        ('stm_scores', ctypes.POINTER(ctypes.c_float)),
         ('stm_WDLs', ctypes.POINTER(ctypes.c_float)),
-        ('legal_moves_idxs', ctypes.POINTER(ctypes.c_int16)),
-        ('best_move_idx', ctypes.POINTER(ctypes.c_uint8)),
+        ('legal_moves_idxs', ctypes.POINTER(ctypes.c_int32)),
+        ('best_move_idx', ctypes.POINTER(ctypes.c_int64)),
+        ('arena', ctypes.POINTER(ctypes.c_uint8)),
+        ('arena_size_bytes', ctypes.c_size_t),
+        ('data_size_bytes', ctypes.c_size_t),
+        ('feature_offsets', ctypes.POINTER(ctypes.c_int32)),
+        ('num_active_features', ctypes.c_size_t),
     ]
 
-    def get_features_tensor(self, is_stm: bool):
-        field = self.active_features_stm if is_stm else self.active_features_ntm
-        arr = np.ctypeslib.as_array(field, shape=(BATCH_SIZE, MAX_PIECES_PER_POS))
-        return torch.from_numpy(arr).to(DEVICE, dtype=torch.int32)
+    # Register this batch's memory (1 contiguous arena) as pinned the 1st time it's seen,
+    # so copying it to the GPU needs no staging copy
+    # Batches are reused, so each arena is registered once
+    def pin_memory(self):
+        if DEVICE.type != "cuda":
+            return
+
+        address = ctypes.addressof(self.arena.contents)
+
+        if address not in pinned_arenas:
+            cudart = torch.cuda.cudart()
+            torch.cuda.check_error(cudart.cudaHostRegister(address, self.arena_size_bytes, 0))
+            pinned_arenas.add(address)
+
+    # Copies this batch to DEVICE in 1 copy of its arena (see DeviceBatch)
+    # The copy is synchronous, so the dataloader can reuse this batch's memory right after
+    def to_device(self):
+        return DeviceBatch(self)
 
-    def get_legal_moves_idxs_tensor(self):
-        arr = np.ctypeslib.as_array(self.legal_moves_idxs, shape=(BATCH_SIZE, MAX_MOVES_PER_POS))
-        return torch.from_numpy(arr).to(DEVICE, dtype=torch.int32)
+# A batch's arrays on DEVICE, each a view of 1 copy of the batch's arena
+# The arrays are already in the dtypes the kernels and losses take, so nothing is converted
+class DeviceBatch:
+    def __init__(self, batch: Batch):
+        arena_address = ctypes.addressof(batch.arena.contents)
+        host_arena = np.ctypeslib.as_array(batch.arena, shape=(batch.data_size_bytes,))
 
-    def get_stm_scores_tensor(self):
-        arr = np.ctypeslib.as_array(self.stm_scores, shape=(BATCH_SIZE, 1))
-        return torch.from_numpy(arr).to(DEVICE, dtype=torch.float32)
+        # Force a copy in case DEVICE is the CPU
+        arena = torch.from_numpy(host_arena).to(DEVICE, copy=True)
 
-    def get_stm_wdl_tensor(self):
-        arr = np.ctypeslib.as_array(self.stm_WDLs, shape=(BATCH_SIZE, 1))
-        return torch.from_numpy(arr).to(DEVICE, dtype=torch.float32)
+        # Every array starts at a multiple of 64 bytes in the arena, so any dtype can view it
+        def view(field, dtype: torch.dtype, shape: tuple):
+            offset = ctypes.cast(field, ctypes.c_void_p).value - arena_address
+            num_bytes = math.prod(shape) * ctypes.sizeof(field._type_)
+            return arena[offset : offset + num_bytes].view(dtype).view(shape)
 
-    def get_target_policy_tensor(self):
-        arr = np.ctypeslib.as_array(self.best_move_idx, shape=(BATCH_SIZE, 1))
-        best_move_idx_tensor = torch.from_numpy(arr).to(DEVICE, dtype=torch.int)
+        # With CSR_FEATURES, 1D tensors of every entry's features (see feature_offsets)
+        features_shape = (batch.num_active_features,) if CSR_FEATURES \
+            else (BATCH_SIZE, MAX_PIECES_PER_POS)
 
-        result_tensor = torch.zeros(
-            BATCH_SIZE, MAX_MOVES_PER_POS, dtype=torch.float32, device=DEVICE
+        self.stm_features = view(batch.active_features_stm, torch.int32, features_shape)
+        self.ntm_features = view(batch.active_features_ntm, torch.int32, features_shape)
+
+        # Only with CSR_FEATURES
+        # The features of entry i are features[offsets[i]:offsets[i + 1]]
+        self.feature_offsets = view(batch.feature_offsets, torch.int32, (BATCH_SIZE + 1,)) \
+            if CSR_FEATURES else None
+
+        self.legal_moves_idxs = view(
+            batch.legal_moves_idxs, torch.int32, (BATCH_SIZE, MAX_MOVES_PER_POS)
         )
 
-        result_tensor.scatter_(1, best_move_idx_tensor, 1.0)
+        self.stm_scores = view(batch.stm_scores, torch.float32, (BATCH_SIZE, 1))
+        self.stm_wdl = view(batch.stm_WDLs, torch.float32, (BATCH_SIZE, 1))
+
+        # Policy target as class indices (index of the best move in legal_moves_idxs),
+        # as taken by torch.nn.CrossEntropyLoss
+        self.target_policy = view(batch.best_move_idx, torch.int64, (BATCH_SIZE,))
+
+# Must be called before the dataloader frees the batches (dataloader.shutdown())
+def unpin_batches_memory():
+    for address in pinned_arenas:
+        torch.cuda.check_error(torch.cuda.cudart().cudaHostUnregister(address))
 
-        return result_tensor
+    pinned_arenas.clear()
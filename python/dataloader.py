@@ -0,0 +1,178 @@
+from settings import *
+from batch import Batch
+import ctypes
+import os
+import torch
+
+# Must match the DataloaderOptions struct in cpp/dataloader/options.hpp
+class DataloaderOptions(ctypes.Structure):
+    _fields_ = [
+        ('use_mmap', ctypes.c_bool),
+        ('shuffle', ctypes.c_bool),
+        ('shuffle_seed', ctypes.c_uint64),
+        ('shuffle_window_batches', ctypes.c_uint64),
+        ('prefetch_batches', ctypes.c_uint64),
+        ('deterministic', ctypes.c_bool),
+        ('threads_per_batch', ctypes.c_uint64),
+        ('contiguous_chunk_bytes', ctypes.c_uint64),
+        ('use_huge_pages', ctypes.c_bool),
+        ('csr_features', ctypes.c_bool),
+        ('pin_threads', ctypes.c_bool),
+        ('cpu_list', ctypes.c_char_p),
+        ('consumer_numa_node', ctypes.c_int64),
+        ('batch_cache_bytes', ctypes.c_uint64),
+        ('trust_stamped_data', ctypes.c_bool),
+        ('filter_entries', ctypes.c_bool),
+        ('filter_max_abs_score', ctypes.c_uint16),
+        ('filter_results', ctypes.c_uint8),
+        ('filter_min_pieces', ctypes.c_uint8),
+        ('filter_max_pieces', ctypes.c_uint8),
+        ('filter_in_check', ctypes.c_bool),
+        ('filter_min_legal_moves', ctypes.c_uint8),
+        ('filter_max_legal_moves', ctypes.c_uint8),
+        ('trace_path', ctypes.c_char_p),
+        ('rank', ctypes.c_uint64),
+        ('world_size', ctypes.c_uint64),
+        ('feature_set', ctypes.c_char_p),
+    ]
+
+# Must match the WorkerStats struct in cpp/dataloader/stats.hpp
+class WorkerStats(ctypes.Structure):
+    _fields_ = [
+        ('read_ns', ctypes.c_uint64),
+        ('decode_ns', ctypes.c_uint64),
+        ('movegen_ns', ctypes.c_uint64),
+        ('batches_produced', ctypes.c_uint64),
+        ('batches_from_cache', ctypes.c_uint64),
+        ('entries_filtered', ctypes.c_uint64),
+        ('batches_skipped', ctypes.c_uint64),
+        ('entries_skipped', ctypes.c_uint64),
+    ]
+
+# NUMA node of the GPU's PCIe root (Linux), or -1 if unknown
+def gpu_numa_node():
+    if DEVICE.type != "cuda":
+        return -1
+
+    props = torch.cuda.get_device_properties(DEVICE)
+
+    if not hasattr(props, "pci_bus_id"):
+        return -1
+
+    pci_address = "{:04x}:{:02x}:{:02x}.0".format(
+        props.pci_domain_id, props.pci_bus_id, props.pci_device_id
+    )
+
+    try:
+        with open("/sys/bus/pci/devices/{}/numa_node".format(pci_address)) as numa_node_file:
+            return int(numa_node_file.read())
+    except (OSError, ValueError):
+        return -1
+
+def load_dataloader():
+    dll_exists = os.path.exists("./dataloader.dll")
+    so_exists = os.path.exists("./dataloader.so")
+    assert dll_exists or so_exists
+    dataloader = ctypes.CDLL("./dataloader.dll" if dll_exists else "./dataloader.so")
+
+    # Define dataloader functions
+
+    dataloader.init.argtypes = [
+        ctypes.c_char_p, ctypes.c_size_t, ctypes.c_size_t, ctypes.POINTER(DataloaderOptions)
+    ]
+
+    dataloader.init.restype = None # void
+
+    dataloader.next_batch.argtypes = [ctypes.c_size_t]
+    dataloader.next_batch.restype = ctypes.POINTER(Batch)
+
+    dataloader.release_batch.argtypes = [ctypes.POINTER(Batch)]
+    dataloader.release_batch.restype = None # void
+
+    dataloader.shutdown.argtypes = []
+    dataloader.shutdown.restype = None # void
+
+    dataloader.num_sources.argtypes = []
+    dataloader.num_sources.restype = ctypes.c_size_t
+
+    dataloader.get_positions_served.argtypes = [ctypes.POINTER(ctypes.c_uint64)]
+    dataloader.get_positions_served.restype = None # void
+
+    dataloader.get_stats.argtypes = [ctypes.POINTER(WorkerStats)]
+    dataloader.get_stats.restype = ctypes.c_uint64
+
+    dataloader.reset_stats.argtypes = []
+    dataloader.reset_stats.restype = None # void
+
+    dataloader.trace_begin.argtypes = [ctypes.c_char_p]
+    dataloader.trace_begin.restype = None # void
+
+    dataloader.trace_end.argtypes = []
+    dataloader.trace_end.restype = None # void
+
+    dataloader.get_state.argtypes = [ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t]
+    dataloader.get_state.restype = ctypes.c_size_t
+
+    dataloader.set_state.argtypes = [ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t]
+    dataloader.set_state.restype = None # void
+
+    # Init dataloader
+
+    options = DataloaderOptions(
+        use_mmap=DATALOADER_MMAP,
+        shuffle=SHUFFLE,
+        shuffle_seed=SHUFFLE_SEED,
+        shuffle_window_batches=SHUFFLE_WINDOW_BATCHES,
+        prefetch_batches=PREFETCH_BATCHES,
+        deterministic=DETERMINISTIC_ORDER,
+        threads_per_batch=THREADS_PER_BATCH,
+        contiguous_chunk_bytes=CONTIGUOUS_CHUNK_MB * 1024 * 1024,
+        use_huge_pages=DATALOADER_HUGE_PAGES,
+        csr_features=CSR_FEATURES,
+        pin_threads=DATALOADER_PIN_THREADS,
+        cpu_list=DATALOADER_CPU_LIST.encode("utf-8"),
+        consumer_numa_node=gpu_numa_node() if DATALOADER_PIN_THREADS else -1,
+        batch_cache_bytes=BATCH_CACHE_MB * 1024 * 1024,
+        trust_stamped_data=TRUST_STAMPED_DATA,
+        filter_entries=FILTER_ENTRIES,
+        filter_max_abs_score=FILTER_MAX_ABS_SCORE,
+        filter_results=sum(1 << result for result in FILTER_RESULTS),
+        filter_min_pieces=FILTER_MIN_PIECES,
+        filter_max_pieces=FILTER_MAX_PIECES,
+        filter_in_check=FILTER_IN_CHECK,
+        filter_min_legal_moves=FILTER_MIN_LEGAL_MOVES,
+        filter_max_legal_moves=FILTER_MAX_LEGAL_MOVES,
+        trace_path=DATALOADER_TRACE_PATH.encode("utf-8"),
+        rank=DATALOADER_RANK,
+        world_size=DATALOADER_WORLD_SIZE,
+        feature_set=FEATURE_SET.encode("utf-8")
+    )
+
+    dataloader.init(DATA_FILE_PATH.encode("utf-8"), BATCH_SIZE, CPU_THREADS, ctypes.byref(options))
+
+    return dataloader
+
+# Positions decoded into the batches served so far (not counting those served before set_state())
+# from each data file of DATA_FILE_PATH (several if it's a manifest)
+def get_positions_served(dataloader):
+    positions_served = (ctypes.c_uint64 * dataloader.num_sources())()
+    dataloader.get_positions_served(positions_served)
+    return list(positions_served)
+
+# Returns the stats of each dataloader thread and the seconds next_batch() waited for them
+def get_stats(dataloader):
+    worker_stats = (WorkerStats * CPU_THREADS)()
+    consumer_stall_ns = dataloader.get_stats(worker_stats)
+    return list(worker_stats), consumer_stall_ns / 1e9
+
+# Bytes to store in a checkpoint, so set_state() can resume the exact same stream of batches
+def get_state(dataloader):
+    state_size = dataloader.get_state(None, 0)
+    state = (ctypes.c_uint8 * state_size)()
+    dataloader.get_state(state, state_size)
+    return bytes(state)
+
+# Must be called before the 1st next_batch(), with the same data and shuffle settings
+def set_state(dataloader, state: bytes):
+    state = (ctypes.c_uint8 * len(state)).from_buffer_copy(state)
+    dataloader.set_state(state, len(state))
@@ -79,7 +79,10 @@ def get_move_idx(move: chess.Move, board_oriented: chess.Board) -> int:
     return idx
 
 # The policy is a dictionary that maps chess.Move to tuple (logit: float, move_policy: float)
+# Computes the "starway" features (see cpp/dataloader/feature_sets.hpp)
 def get_value_and_policy(net: NetValuePolicy, board: chess.Board) -> (int, dict):
+    assert FEATURE_SET == "starway"
+
     board_oriented = board.copy() if board.turn == chess.WHITE else get_flipped_board(board)
 
     stm_features_tensor = torch.zeros(32, device=DEVICE, dtype=torch.int32) - 1
@@ -9,15 +9,21 @@ KERNEL_THREADS_COUNT = HIDDEN_SIZE
 
 ft_forward_kernel = "ft_forward_kernel"
 ft_backward_kernel = "ft_backward_kernel"
+ft_forward_csr_kernel = "ft_forward_csr_kernel"
+ft_backward_csr_kernel = "ft_backward_csr_kernel"
 
 module = cp.RawModule(
     code=open('cuda/ft_kernels.cu').read(),
     options=("-std=c++14", "-O3"),
-    name_expressions=[ft_forward_kernel, ft_backward_kernel]
+    name_expressions=[
+        ft_forward_kernel, ft_backward_kernel, ft_forward_csr_kernel, ft_backward_csr_kernel
+    ]
 )
 
 ft_forward_kernel = module.get_function(ft_forward_kernel)
 ft_backward_kernel = module.get_function(ft_backward_kernel)
+ft_forward_csr_kernel = module.get_function(ft_forward_csr_kernel)
+ft_backward_csr_kernel = module.get_function(ft_backward_csr_kernel)
 
 class FeatureTransformerFunction(torch.autograd.Function):
     @staticmethod
@@ -87,6 +93,95 @@ class FeatureTransformerFunction(torch.autograd.Function):
 
         return None, w_grad, b_grad
 
+# The active features of entry i are active_features[feature_offsets[i]:feature_offsets[i + 1]]
+class FeatureTransformerCSRFunction(torch.autograd.Function):
+    @staticmethod
+    def forward(
+        ctx,
+        active_features: torch.Tensor,
+        feature_offsets: torch.Tensor,
+        weights: torch.Tensor,
+        biases: torch.Tensor
+    ):
+        for tensor in [active_features, feature_offsets]:
+            assert len(tensor.shape) == 1
+            assert tensor.dtype == torch.int32
+            assert tensor.device == DEVICE
+            assert tensor.is_cuda
+            assert tensor.is_contiguous()
+
+        assert len(weights.shape) == 2
+        assert weights.dtype == torch.float32
+        assert weights.device == DEVICE
+        assert weights.is_cuda
+        assert weights.is_contiguous()
+
+        assert len(biases.shape) == 1
+        assert biases.dtype == torch.float32
+        assert biases.device == DEVICE
+        assert biases.is_cuda
+        assert biases.is_contiguous()
+
+        ctx.save_for_backward(active_features, feature_offsets, weights, biases)
+
+        batch_size = feature_offsets.shape[0] - 1
+
+        output = torch.empty(
+            batch_size,
+            HIDDEN_SIZE,
+            dtype=torch.float32,
+            device=DEVICE,
+            requires_grad=True
+        )
+
+        kernel_blocks_count = batch_size
+
+        ft_forward_csr_kernel(
+            (kernel_blocks_count,),
+            (KERNEL_THREADS_COUNT,),
+            (
+                active_features.data_ptr(),
+                feature_offsets.data_ptr(),
+                weights.data_ptr(),
+                biases.data_ptr(),
+                output.data_ptr()
+            )
+        )
+
+        return output
+
+    @staticmethod
+    def backward(ctx, out_grad):
+        assert not ctx.needs_input_grad[0]
+        assert not ctx.needs_input_grad[1]
+        assert ctx.needs_input_grad[2]
+        assert ctx.needs_input_grad[3]
+
+        active_features, feature_offsets, weights, biases = ctx.saved_tensors
+
+        batch_size = feature_offsets.shape[0] - 1
+
+        out_grad = out_grad.contiguous()
+
+        w_grad = torch.zeros(weights.shape, dtype=torch.float32, device=DEVICE)
+        b_grad = torch.zeros(biases.shape, dtype=torch.float32, device=DEVICE)
+
+        kernel_blocks_count = batch_size
+
+        ft_backward_csr_kernel(
+            (kernel_blocks_count,),
+            (KERNEL_THREADS_COUNT,),
+            (
+                active_features.data_ptr(),
+                feature_offsets.data_ptr(),
+                w_grad.data_ptr(),
+                b_grad.data_ptr(),
+                out_grad.data_ptr()
+            )
+        )
+
+        return None, None, w_grad, b_grad
+
 class FeatureTransformer(torch.nn.Module):
     def __init__(self, num_inputs: int, num_outputs: int):
         super(FeatureTransformer, self).__init__()
@@ -97,5 +192,11 @@ class FeatureTransformer(torch.nn.Module):
 
         self.bias = torch.nn.Parameter(torch.rand(num_outputs, dtype=torch.float32) * 0.2 - 0.1)
 
-    def forward(self, active_features: torch.Tensor):
-        return FeatureTransformerFunction.apply(active_features, self.weight, self.bias)
+    # If feature_offsets is given, active_features are in CSR layout (see FeatureTransformerCSRFunction)
+    def forward(self, active_features: torch.Tensor, feature_offsets: torch.Tensor = None):
+        if feature_offsets is None:
+            return FeatureTransformerFunction.apply(active_features, self.weight, self.bias)
+
+        return FeatureTransformerCSRFunction.apply(
+            active_features, feature_offsets, self.weight, self.bias
+        )
@@ -31,15 +31,22 @@ class NetValuePolicy(torch.nn.Module):
             torch.nn.init.uniform_(self.hidden_to_out_policy.weight, -0.1, 0.1)
             torch.nn.init.uniform_(self.hidden_to_out_policy.bias, -0.1, 0.1)
 
-    def forward(self, stm_features_tensor, ntm_features_tensor, legal_moves_idxs_tensor):
+    # If feature_offsets_tensor is given, the features tensors are in CSR layout (see Batch)
+    def forward(
+        self,
+        stm_features_tensor,
+        ntm_features_tensor,
+        legal_moves_idxs_tensor,
+        feature_offsets_tensor=None
+    ):
         assert stm_features_tensor.dtype == ntm_features_tensor.dtype
         assert len(stm_features_tensor.size()) == len(ntm_features_tensor.size())
 
         # [BATCH_SIZE, HIDDEN_SIZE]
-        hidden_stm = self.ft(stm_features_tensor)
-        hidden_ntm = self.ft(ntm_features_tensor)
+        hidden_stm = self.ft(stm_features_tensor, feature_offsets_tensor)
+        hidden_ntm = self.ft(ntm_features_tensor, feature_offsets_tensor)
 
-        dim = len(stm_features_tensor.size()) - 1
+        dim = len(hidden_stm.size()) - 1
 
         # [BATCH_SIZE, HIDDEN_SIZE * 2]
         hidden_layer = torch.cat([hidden_stm, hidden_ntm], dim=dim)
@@ -12,8 +12,19 @@ NET_NAME = "net"
 # Set to a .pt file to resume training, else set to None
 CHECKPOINT_TO_LOAD = None
 
+# Input feature set the dataloader computes, by name (see cpp/dataloader/feature_sets.hpp)
+# Pre-featurized data files (converter's --featurized) only have the "starway" features
+FEATURE_SET = "starway"
+
+# Must match the feature sets in cpp/dataloader/feature_sets.hpp
+FEATURE_SET_INPUT_SIZES = {
+    "starway": 768 * 2,
+    "no-mirror": 768 * 2,
+    "king-buckets-4": 768 * 2 * 4,
+}
+
 # Layer sizes
-INPUT_SIZE = 768 * 2
+INPUT_SIZE = FEATURE_SET_INPUT_SIZES[FEATURE_SET]
 HIDDEN_SIZE = 256
 POLICY_OUTPUT_SIZE = 6 * 64 * 6 # Piece type moved, dst square, piece type captured
 
@@ -27,10 +38,94 @@ END_SUPERBATCH = 600
 
 SAVE_INTERVAL = 30 # Save net checkpoint every SAVE_INTERVAL superbatches
 
+# Starway data file, pre-featurized data file (converter's --featurized),
+# compressed data file (converter's --compressed),
+# or .manifest file listing data files to mix in every batch (see README)
 DATA_FILE_PATH = "data.sw"
 BATCH_SIZE = 16384
 CPU_THREADS = 12
 
+# Memory-map the data file (shared by all dataloader threads) instead of reading it with streams
+DATALOADER_MMAP = True
+
+# Shuffle the order of batch-sized blocks of the data file every epoch (seeded),
+# and the positions inside each window of SHUFFLE_WINDOW_BATCHES consecutive blocks
+# Off by default: the data file is then read front to back, in the order it was converted
+SHUFFLE = False
+SHUFFLE_SEED = 42
+SHUFFLE_WINDOW_BATCHES = 16
+
+# Batch buffers per dataloader thread (each thread decodes up to PREFETCH_BATCHES - 1 batches ahead)
+PREFETCH_BATCHES = 3
+
+# If True, batches are always served in the same order (reproducible runs)
+# If False, batches are served as soon as any dataloader thread decodes them (faster)
+DETERMINISTIC_ORDER = False
+
+# Threads decoding each batch (total dataloader threads = CPU_THREADS * THREADS_PER_BATCH)
+# Useful for very large batches, where few batches in flight with more threads each beat
+# many batches in flight
+THREADS_PER_BATCH = 1
+
+# If 0, dataloader threads take turns reading batches from anywhere in the data file
+# Otherwise, each thread reads its own contiguous part of the file sequentially,
+# CONTIGUOUS_CHUNK_MB at a time (faster on spinning disks and network filesystems)
+# With SHUFFLE, positions are then shuffled within each chunk instead of each shuffle window
+CONTIGUOUS_CHUNK_MB = 0
+
+# Back each batch's memory with transparent huge pages (Linux), for fewer TLB misses
+DATALOADER_HUGE_PAGES = False
+
+# Batches' features without the padding to 32 per position (CSR layout: features + offsets),
+# so less to copy to the GPU and no padding to skip in the feature transformer kernels
+CSR_FEATURES = False
+
+# Pin each dataloader thread to 1 core of DATALOADER_CPU_LIST (Linux only), with each thread's
+# batches on its core's NUMA node, and pin the training loop to the GPU's NUMA node
+# DATALOADER_CPU_LIST is in Linux cpulist format ("0-15,32-47"), or "" for all cores
+DATALOADER_PIN_THREADS = False
+DATALOADER_CPU_LIST = ""
+
+# For data files that fit in RAM: keep up to BATCH_CACHE_MB of decoded batches of the 1st epoch
+# and serve later epochs from them, reshuffled as whole batches, instead of decoding again
+# 0 to disable. Only with a single data file and CONTIGUOUS_CHUNK_MB = 0
+BATCH_CACHE_MB = 0
+
+# Skip re-validating every data entry of data files with a valid stamp (<data file>.stamp,
+# written by the converter), checking each block's checksum once instead
+# Data files without a valid stamp are still fully validated
+TRUST_STAMPED_DATA = False
+
+# Drop data entries when loading them, on top of the converter's filter, so trying a filter
+# doesn't need reconverting. Batches take the next entries kept in their window of
+# SHUFFLE_WINDOW_BATCHES batches instead, none served twice, and batches the filter keeps too few
+# entries to fill are skipped, so it must keep more than 1 in SHUFFLE_WINDOW_BATCHES entries
+# Keeping a fraction f of entries, each window serves floor(f * SHUFFLE_WINDOW_BATCHES) batches,
+# and the kept entries left over at its end are skipped. So an epoch of the data files has
+# floor(f * SHUFFLE_WINDOW_BATCHES) / SHUFFLE_WINDOW_BATCHES of the unfiltered batches, a bit
+# fewer than the kept entries fill. Batches and entries skipped are logged every superbatch
+# Only entries with abs(score) <= FILTER_MAX_ABS_SCORE, a side-to-move result in FILTER_RESULTS
+# (0 loss, 1 draw, 2 win), FILTER_MIN_PIECES to FILTER_MAX_PIECES pieces, side to move not in check
+# if FILTER_IN_CHECK and FILTER_MIN_LEGAL_MOVES to FILTER_MAX_LEGAL_MOVES legal moves are kept
+FILTER_ENTRIES = False
+FILTER_MAX_ABS_SCORE = 32767
+FILTER_RESULTS = [0, 1, 2]
+FILTER_MIN_PIECES = 2
+FILTER_MAX_PIECES = 32
+FILTER_IN_CHECK = False
+FILTER_MIN_LEGAL_MOVES = 1
+FILTER_MAX_LEGAL_MOVES = 255
+
+# If not "", record when dataloader threads read, decode and wait, and when training steps run,
+# and write it to this file as Chrome trace JSON when training ends (open in ui.perfetto.dev)
+DATALOADER_TRACE_PATH = ""
+
+# With 1 training process per GPU or CPU socket, each one loads a different 1/WORLD_SIZE
+# of every epoch of the data file (same settings and shuffle seed, different rank)
+# Defaults to the RANK and WORLD_SIZE environment variables set by torchrun
+DATALOADER_RANK = int(os.environ.get("RANK", 0))
+DATALOADER_WORLD_SIZE = int(os.environ.get("WORLD_SIZE", 1))
+
 # Learning rate schedule
 LR = 0.001 * (0.99**(START_SUPERBATCH - 1))
 LR_DROP_INTERVAL = 1
@@ -59,6 +154,19 @@ assert SAVE_INTERVAL > 0
 assert os.path.exists(DATA_FILE_PATH)
 assert BATCH_SIZE > 0
 assert CPU_THREADS > 0
+assert SHUFFLE_SEED >= 0
+assert SHUFFLE_WINDOW_BATCHES > 0
+assert PREFETCH_BATCHES > 0
+assert THREADS_PER_BATCH > 0 and THREADS_PER_BATCH <= BATCH_SIZE
+assert CONTIGUOUS_CHUNK_MB >= 0
+assert BATCH_CACHE_MB >= 0
+assert FILTER_MAX_ABS_SCORE >= 0 and FILTER_MAX_ABS_SCORE <= 32767
+assert len(FILTER_RESULTS) > 0 and all(result in [0, 1, 2] for result in FILTER_RESULTS)
+assert FILTER_MIN_PIECES <= FILTER_MAX_PIECES and FILTER_MAX_PIECES <= 32
+assert FILTER_MIN_LEGAL_MOVES <= FILTER_MAX_LEGAL_MOVES and FILTER_MAX_LEGAL_MOVES <= 255
+assert DATALOADER_WORLD_SIZE > 0
+assert DATALOADER_RANK >= 0 and DATALOADER_RANK < DATALOADER_WORLD_SIZE
+if BATCH_CACHE_MB > 0: assert CONTIGUOUS_CHUNK_MB == 0
 assert LR > 0.0 and LR_DROP_INTERVAL > 0 and LR_MULTIPLIER > 0.0
 assert WDL_WEIGHT >= 0.0 and WDL_WEIGHT <= 1.0
 assert VALUE_LOSS_WEIGHT >= 0.0 and VALUE_LOSS_WEIGHT <= 1.0
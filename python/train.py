@@ -1,7 +1,7 @@
 from settings import *
-from batch import Batch
+from batch import Batch, unpin_batches_memory
+from dataloader import load_dataloader, get_positions_served, get_stats, get_state, set_state
 from model import NetValuePolicy
-import ctypes
 import numpy as np
 import torch
 import math
@@ -26,9 +26,19 @@ if __name__ == "__main__":
 
     print("Save interval: every {} superbatches".format(SAVE_INTERVAL))
     print("Data file:", DATA_FILE_PATH)
-    print("Data entries:", os.path.getsize(DATA_FILE_PATH) / 32.0)
+    print("Feature set: {} ({} inputs)".format(FEATURE_SET, INPUT_SIZE))
     print("Batch size:", BATCH_SIZE)
     print("CPU threads:", CPU_THREADS)
+    print("Memory-map data file:", DATALOADER_MMAP)
+
+    print("Shuffle: {} (seed {}, window of {} batches)"
+        .format(SHUFFLE, SHUFFLE_SEED, SHUFFLE_WINDOW_BATCHES))
+
+    print("Prefetch batches per CPU thread:", PREFETCH_BATCHES)
+    print("Deterministic batch order:", DETERMINISTIC_ORDER)
+    print("Threads per batch:", THREADS_PER_BATCH)
+    print("Contiguous chunk MB:", CONTIGUOUS_CHUNK_MB)
+    print("Dataloader rank: {} of {}".format(DATALOADER_RANK, DATALOADER_WORLD_SIZE))
 
     print("LR: start {} multiply by {} every {} superbatches"
         .format(LR, LR_MULTIPLIER, LR_DROP_INTERVAL))
@@ -36,20 +46,8 @@ if __name__ == "__main__":
     print("WDL weight for value head:", WDL_WEIGHT)
     print("FT params clipping: [{}, {}]".format(-FT_MAX_WEIGHT_BIAS, FT_MAX_WEIGHT_BIAS))
 
-    # Create dataloader
-    dll_exists = os.path.exists("./dataloader.dll")
-    so_exists = os.path.exists("./dataloader.so")
-    assert dll_exists or so_exists
-    dataloader = ctypes.CDLL("./dataloader.dll" if dll_exists else "./dataloader.so")
-
-    # Define dataloader functions
-    dataloader.init.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_size_t]
-    dataloader.init.restype = None # void
-    dataloader.next_batch.argtypes = [ctypes.c_size_t]
-    dataloader.next_batch.restype = ctypes.POINTER(Batch)
-
-    # Init dataloader
-    dataloader.init(DATA_FILE_PATH.encode("utf-8"), BATCH_SIZE, CPU_THREADS)
+    # Create and init dataloader
+    dataloader = load_dataloader()
 
     print()
 
@@ -78,6 +76,12 @@ if __name__ == "__main__":
         optimizer.load_state_dict(checkpoint["optimizer"])
         lr_scheduler.load_state_dict(checkpoint["lr_scheduler"])
 
+        # Continue the stream of batches where it stopped, instead of from the start
+        if "dataloader" in checkpoint:
+            set_state(dataloader, checkpoint["dataloader"])
+        else:
+            print("Checkpoint has no dataloader state, data starts from the beginning")
+
     ce_fn = torch.nn.CrossEntropyLoss()
 
     for superbatch_num in range(START_SUPERBATCH, END_SUPERBATCH + 1):
@@ -89,24 +93,36 @@ if __name__ == "__main__":
             print("LR for superbatch #{}:".format(superbatch_num), round(param_group['lr'], 8))
 
         for batch_num in range(1, BATCHES_PER_SUPERBATCH + 1):
-            batch = dataloader.next_batch(BATCH_SIZE).contents
+            batch_ptr = dataloader.next_batch(BATCH_SIZE)
+            batch = batch_ptr.contents
+            batch.pin_memory()
+
+            device_batch = batch.to_device()
+
+            # device_batch is a copy, so the dataloader can reuse this batch's memory
+            dataloader.release_batch(batch_ptr)
+
+            # .item() below waits for the forward pass on the GPU, backward and optimizer kernels
+            # may still be running when the span ends
+            dataloader.trace_begin(b"train step")
 
             optimizer.zero_grad(set_to_none=True)
 
             pred_value, pred_logits = net.forward(
-                batch.get_features_tensor(True),
-                batch.get_features_tensor(False),
-                batch.get_legal_moves_idxs_tensor()
+                device_batch.stm_features,
+                device_batch.ntm_features,
+                device_batch.legal_moves_idxs,
+                device_batch.feature_offsets
             )
 
-            stm_scores = torch.sigmoid(batch.get_stm_scores_tensor() / float(VALUE_SCALE))
-            expected_value = stm_scores * SCORE_WEIGHT + batch.get_stm_wdl_tensor() * WDL_WEIGHT
+            stm_scores = torch.sigmoid(device_batch.stm_scores / float(VALUE_SCALE))
+            expected_value = stm_scores * SCORE_WEIGHT + device_batch.stm_wdl * WDL_WEIGHT
 
             value_abs_diff = torch.abs(torch.sigmoid(pred_value) - expected_value)
             value_loss = torch.pow(value_abs_diff, 2.5).mean()
 
             #pred_policy = torch.nn.functional.softmax(pred_logits, dim=1)
-            policy_loss = ce_fn(pred_logits, batch.get_target_policy_tensor())
+            policy_loss = ce_fn(pred_logits, device_batch.target_policy)
 
             loss = value_loss * VALUE_LOSS_WEIGHT + policy_loss * POLICY_LOSS_WEIGHT
 
@@ -120,6 +136,8 @@ if __name__ == "__main__":
                 net.ft.weight.clamp_(-FT_MAX_WEIGHT_BIAS, FT_MAX_WEIGHT_BIAS)
                 net.ft.bias.clamp_(-FT_MAX_WEIGHT_BIAS, FT_MAX_WEIGHT_BIAS)
 
+            dataloader.trace_end()
+
             # Log every N batches
             if batch_num == 1 or batch_num == BATCHES_PER_SUPERBATCH or batch_num % 64 == 0:
                 positions_seen_this_superbatch = batch_num * BATCH_SIZE
@@ -152,6 +170,36 @@ if __name__ == "__main__":
                     sys.stdout.write(log)
                     sys.stdout.flush()
 
+        # Where dataloader time went this superbatch, summed over its threads
+        # If next_batch() waited a lot, training is bound by the dataloader, else by the GPU
+        worker_stats, consumer_stall_secs = get_stats(dataloader)
+
+        print("Dataloader: read {:.1f}s, decode {:.1f}s, movegen {:.1f}s, {} batches "
+            "({} from cache), {} entries filtered, {} batches ({} entries) skipped, "
+            "waited for by trainer {:.1f}s".format(
+                sum(stats.read_ns for stats in worker_stats) / 1e9,
+                sum(stats.decode_ns for stats in worker_stats) / 1e9,
+                sum(stats.movegen_ns for stats in worker_stats) / 1e9,
+                sum(stats.batches_produced for stats in worker_stats),
+                sum(stats.batches_from_cache for stats in worker_stats),
+                sum(stats.entries_filtered for stats in worker_stats),
+                sum(stats.batches_skipped for stats in worker_stats),
+                sum(stats.entries_skipped for stats in worker_stats),
+                consumer_stall_secs
+            ))
+
+        dataloader.reset_stats()
+
+        # Check the data files are mixed as weighted in the manifest
+        if dataloader.num_sources() > 1:
+            positions_served = get_positions_served(dataloader)
+            total_served = sum(positions_served)
+
+            print("Positions served per data file:", ", ".join(
+                "{} ({:.1%})".format(served, served / total_served)
+                for served in positions_served
+            ))
+
         lr_scheduler.step()
 
         # Save checkpoint as .pt (pytorch file)
@@ -160,7 +208,8 @@ if __name__ == "__main__":
             checkpoint = {
                 "model": net.state_dict(),
                 "optimizer": optimizer.state_dict(),
-                "lr_scheduler": lr_scheduler.state_dict()
+                "lr_scheduler": lr_scheduler.state_dict(),
+                "dataloader": get_state(dataloader)
             }
 
             if not os.path.exists("checkpoints"):
@@ -169,3 +218,6 @@ if __name__ == "__main__":
             pt_file_path = "checkpoints/{}-{}.pt".format(NET_NAME, superbatch_num)
             torch.save(checkpoint, pt_file_path)
             print("Checkpoint saved", pt_file_path)
+
+    unpin_batches_memory()
+    dataloader.shutdown()